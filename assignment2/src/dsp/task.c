@@ -187,6 +187,28 @@ NOTIFY_notify (ID_GPP,
 }
 
 
+/*******************************************************************************
+* PROCEDURE: border_dot
+* PURPOSE: One pixel of the x pass whose kernel is cut off by the border of
+* the row and renormalised to the taps that are left.
+*******************************************************************************/
+static unsigned char border_dot(unsigned char *in, int cols, int c,
+                                unsigned short int *kernel, int center)
+{
+    int cc;
+    unsigned int dot = 0, sum = 0;
+
+    for(cc=(-center); cc<=center; cc++)
+    {
+        if(((c+cc) >= 0) && ((c+cc) < cols))
+        {
+            dot += in[c+cc] * kernel[center+cc];
+            sum += kernel[center+cc];
+        }
+    }
+    return dot/sum;
+}
+
 /*******************************************************************************
 * PROCEDURE: gaussian_smooth
 * PURPOSE: Blur an image with a gaussian filter.
@@ -196,11 +218,13 @@ NOTIFY_notify (ID_GPP,
 
 unsigned short int* gaussian_smooth(unsigned char *image, int rows, int cols)
 {
-    int r, c, rr, cc,     /* Counter variables. */
+    int r, c, rr, cc, k1, /* Counter variables. */
+        lo, hi,           /* The columns lo..hi-1 do not reach the border. */
         windowsize,       /* Dimension of the gaussian kernel. */
         center;           /* Half of the windowsize. */
     unsigned int dot,     /* Dot product summing variable. */
           sum,            /* Sum of the kernel weights variable. */
+          kernelSum,      /* Sum of all the kernel weights. */
           temp;
 
     unsigned short int* smoothedim;
@@ -230,6 +254,10 @@ unsigned short int* gaussian_smooth(unsigned char *image, int rows, int cols)
     * Create a 1-dimensional gaussian smoothing kernel.
     ****************************************************************************/
     center = windowsize / 2;
+    lo = (center < cols) ? center : cols;
+    hi = (cols-center > lo) ? cols-center : lo;
+    kernelSum = 0;
+    for(cc=0; cc<windowsize; cc++) kernelSum += kernel[cc];
 
     /****************************************************************************
     * Allocate a temporary buffer image and the smoothed image.
@@ -246,42 +274,39 @@ unsigned short int* gaussian_smooth(unsigned char *image, int rows, int cols)
     smoothedim = (unsigned short *) image;
 
     /****************************************************************************
-    * Blur in the x - direction.
+    * Blur in the x - direction. The kernel is only cut off in the first and
+    * last center columns, the columns in between are done without tests.
     ****************************************************************************/
     for(r=start; r<rows; r++)
     {
-        for(c=0; c<cols; c++)
+        for(c=0; c<lo; c++)
+            tmp[(r-start)*cols+c] = border_dot(&image[r*cols], cols, c, kernel, center);
+        for(; c<hi; c++)
         {
             dot = 0;
-            sum = 0;
             for(cc=(-center); cc<=center; cc++)
-            {
-                if(((c+cc) >= 0) && ((c+cc) < cols))
-                {
-                    dot += image[r*cols+(c+cc)] * kernel[center+cc];
-                    sum += kernel[center+cc];
-                }
-            }
-            tmp [(r-start)*cols+c] = dot/sum;
+                dot += image[r*cols+(c+cc)] * kernel[center+cc];
+            tmp[(r-start)*cols+c] = dot/kernelSum;
         }
+        for(; c<cols; c++)
+            tmp[(r-start)*cols+c] = border_dot(&image[r*cols], cols, c, kernel, center);
     }
     /****************************************************************************
-    * Blur in the y - direction.
+    * Blur in the y - direction, a row at a time. The rows from 8 on have all
+    * the taps above them, near the bottom only the first k1 taps are left, so
+    * the sum of the taps is worked out once per row.
     ****************************************************************************/
-    for(c=0; c<cols; c++)
+    for(r=8; r<rows-start; r++)
     {
-        for(r=8; r<rows-start; r++)
+        k1 = (r+center >= rows-start) ? rows-start-r+center : windowsize;
+        sum = 0;
+        for(rr=0; rr<k1; rr++) sum += kernel[rr];
+
+        for(c=0; c<cols; c++)
         {
-            sum = 0;
             dot = 0;
-            for(rr=(-center); rr<=center; rr++)
-            {
-                if(((r+rr) >= 0) && ((r+rr) < rows))
-                {
-                    dot += tmp[(r+rr)*cols+c] * kernel[center+rr];
-                    sum += kernel[center+rr];
-                }
-            }
+            for(rr=0; rr<k1; rr++)
+                dot += tmp[(r-center+rr)*cols+c] * kernel[rr];
             temp = ((dot*90/sum));
             smoothedim[(r+start)*cols+c] = temp;
         }
@@ -56,10 +56,902 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
 #include "canny_edge.h"
+#include "hysteresis.h"
+#include "dispatch.h"
+#include "pgm_io.h"
+#include "Timer.h"
 
+#define VERBOSE 0
+#define BOOSTBLURFACTOR 90.0
 
+/*******************************************************************************
+* PROCEDURE: write_direction
+* PURPOSE: Write the direction of the edge gradient, in radians, to fname.
+*******************************************************************************/
+static void write_direction(short int *delta_x, short int *delta_y, int rows, int cols,
+                            char *fname, Timer *radian)
+{
+    FILE *fpdir=NULL;          /* File to write the gradient image to.     */
+    float *dir_radians=NULL;   /* Gradient direction image.                */
+
+    startTimer(radian);
+    stages.radian_direction(delta_x, delta_y, rows, cols, &dir_radians, -1, -1);
+    stopTimer(radian);
+    printTimer(radian);
+
+    if((fpdir = fopen(fname, "wb")) == NULL)
+    {
+        fprintf(stderr, "Error opening the file %s for writing.\n", fname);
+        exit(1);
+    }
+    fwrite(dir_radians, sizeof(float), rows*cols, fpdir);
+    fclose(fpdir);
+    free(dir_radians);
+}
+
+/*******************************************************************************
+* PROCEDURE: put_le
+* PURPOSE: Store the n low bytes of v at p, least significant first.
+*******************************************************************************/
+static unsigned char *put_le(unsigned char *p, unsigned int v, int n)
+{
+    for(; n>0; n--,v>>=8) *p++ = (unsigned char)(v & 0xff);
+    return p;
+}
+
+/*******************************************************************************
+* PROCEDURE: write_subpixel
+* PURPOSE: Write the candidates the hysteresis made edges, with the fit
+* nms_subpixel_row gave them, to fname. All numbers are little endian. The
+* file starts with the four bytes "CSPX" and the rows, the columns and the
+* number of records as 32 bit integers, then ten bytes for each edge in
+* raster order:
+*     x, y        the pixel, 16 bits each
+*     offset      how far the magnitude peaks from the pixel centre along
+*                 the gradient, in 1/SUBPIXEL_ONE pixels, 16 bits signed
+*     direction   the gradient, SUBPIXEL_TURN per turn counterclockwise
+*                 from the x axis with y up, 16 bits
+*     strength    the magnitude of the gradient, 16 bits
+* So the edge is at x + offset*cos(t), y - offset*sin(t) for the angle t.
+*******************************************************************************/
+void write_subpixel(const char *fname, const nms_candidates *cand, const unsigned char *edge,
+                    int rows, int cols)
+{
+    FILE *fp;
+    int k, n, strength;
+    unsigned char header[16], record[10], *p;
+
+    for(k=n=0; k<cand->count; k++)
+        if(edge[cand->pos[k]] == EDGE) n++;
+
+    if((fp = fopen(fname, "wb")) == NULL)
+    {
+        fprintf(stderr, "Error opening the file %s for writing.\n", fname);
+        exit(1);
+    }
+    p = put_le(header, 'C' | 'S' << 8 | 'P' << 16 | (unsigned int)'X' << 24, 4);
+    p = put_le(p, rows, 4);
+    p = put_le(p, cols, 4);
+    put_le(p, n, 4);
+    fwrite(header, 1, sizeof(header), fp);
+
+    for(k=0; k<cand->count; k++)
+    {
+        if(edge[cand->pos[k]] != EDGE) continue;
+        strength = (options.magnitude == MAGNITUDE_SQUARED) ?
+                   (int)(0.5 + sqrt((double)cand->mag[k])) : cand->mag[k];
+        p = put_le(record, cand->pos[k] % cols, 2);
+        p = put_le(p, cand->pos[k] / cols, 2);
+        p = put_le(p, (unsigned short) cand->offset[k], 2);
+        p = put_le(p, cand->direction[k], 2);
+        put_le(p, (strength > 65535) ? 65535 : strength, 2);
+        fwrite(record, 1, sizeof(record), fp);
+    }
+    fclose(fp);
+}
+
+/*******************************************************************************
+* PROCEDURE: write_edge_pbm
+* PURPOSE: Write the edges of mask to fname as a PBM bitmap, the edges black.
+* The bits of a PBM row go from the high bit of each byte down, so the bytes
+* of each word of the mask are reversed bitwise, a word at a time.
+*******************************************************************************/
+void write_edge_pbm(const char *fname, const edge_mask *mask)
+{
+    int r, b, bytes = (mask->cols + 7) / 8;
+    unsigned char *pbm, *row;
+    bitword x = 0;
+
+    if((pbm = (unsigned char *) malloc(mask->rows*bytes)) == NULL)
+    {
+        fprintf(stderr, "Error allocating the PBM image.\n");
+        exit(1);
+    }
+    for(r=0,row=pbm; r<mask->rows; r++,row+=bytes)
+    {
+        for(b=0; b<bytes; b++)
+        {
+            if(b % 8 == 0)
+            {
+                x = mask->bits[r*mask->words + b/8];
+                x = ((x >> 1) & 0x5555555555555555ULL) | ((x & 0x5555555555555555ULL) << 1);
+                x = ((x >> 2) & 0x3333333333333333ULL) | ((x & 0x3333333333333333ULL) << 2);
+                x = ((x >> 4) & 0x0f0f0f0f0f0f0f0fULL) | ((x & 0x0f0f0f0f0f0f0f0fULL) << 4);
+            }
+            row[b] = (unsigned char)(x >> 8*(b % 8));
+        }
+    }
+    if(write_pbm_image((char *) fname, pbm, mask->rows, mask->cols, "") == 0)
+    {
+        fprintf(stderr, "Error writing the edge bitmap, %s.\n", fname);
+        exit(1);
+    }
+    free(pbm);
+}
+
+/*******************************************************************************
+* PROCEDURE: canny
+* PURPOSE: To perform canny edge detection on the GPP only. This is the
+* pipeline used by the host build, the board build splits the smoothing
+* between the NEON and the DSP in pool_notify_Execute. Every stage is called
+* through the stages table, so dispatch_init() must have been called.
+* NAME: Mike Heath
+* DATE: 2/15/96
+*******************************************************************************/
+void canny(unsigned char *image, int rows, int cols, float sigma,
+           float tlow, float thigh, unsigned char **edge, char *fname)
+{
+    unsigned char *nms;        /* Points that are local maximal magnitude. */
+    short int *smoothedim,     /* The image after gaussian smoothing.      */
+          *delta_x,        /* The first devivative image, x-direction. */
+          *delta_y,        /* The first derivative image, y-direction. */
+          *magnitude=NULL; /* The magnitude of the gadient image.      */
+    int *magsq=NULL;           /* Its square, for MAGNITUDE_SQUARED.       */
+    nms_candidates cand;       /* The pixels of nms that may be edges.     */
+    edge_mask mask = { 0, 0, 0, NULL }; /* The edges, packed to bits.      */
+    Timer gaussian, gradient, derivative, radian, magnitudeTimer, nonmax, hysteresis;
+
+    initTimer(&gaussian, "gaussian");
+    initTimer(&gradient, "gradient+nonmax");
+    initTimer(&derivative, "derivative");
+    initTimer(&radian, "radian");
+    initTimer(&magnitudeTimer, "magnitude");
+    initTimer(&nonmax, "nonmax");
+    initTimer(&hysteresis, "hysteresis");
+
+    /****************************************************************************
+    * Perform gaussian smoothing on the image using the input standard
+    * deviation. The derivative of gaussian needs no smoothed image.
+    ****************************************************************************/
+    smoothedim = NULL;
+    if(options.gradient != GRADIENT_DOG)
+    {
+        startTimer(&gaussian);
+        smoothedim = (short int *) select_smoother(sigma)(image, rows, cols, sigma, rows);
+        stopTimer(&gaussian);
+        printTimer(&gaussian);
+    }
+
+    if(options.magnitude == MAGNITUDE_SQUARED)
+    {
+        if((magsq = (int *) malloc(rows*cols* sizeof(int))) == NULL)
+        {
+            fprintf(stderr, "Error allocating the squared magnitude image.\n");
+            exit(1);
+        }
+    }
+    else if((magnitude = (short *) malloc(rows*cols* sizeof(short))) == NULL)
+    {
+        fprintf(stderr, "Error allocating the magnitude image.\n");
+        exit(1);
+    }
+    if((nms = (unsigned char *) malloc(rows*cols*sizeof(unsigned char)))==NULL)
+    {
+        fprintf(stderr, "Error allocating the nms image.\n");
+        exit(1);
+    }
 
+    nms_candidates_init(&cand);
+    cand.subpixel = (options.subpixel != NULL);
+
+    /****************************************************************************
+    * Compute the derivatives, the magnitude of the gradient and the non-maximal
+    * suppression in one pass, unless the direction of the gradient has to be
+    * written out and the derivative images are needed in full. The squared
+    * magnitude is only computed in one pass, the direction is then written
+    * from derivatives of its own. The derivative of gaussian makes the
+    * derivative images straight from the image.
+    ****************************************************************************/
+    if(options.gradient == GRADIENT_DOG)
+    {
+        startTimer(&derivative);
+        stages.derivative_of_gaussian(image, rows, cols, sigma, &delta_x, &delta_y);
+        stopTimer(&derivative);
+        printTimer(&derivative);
+
+        if(fname != NULL) write_direction(delta_x, delta_y, rows, cols, fname, &radian);
+
+        startTimer(&nonmax);
+        if(options.magnitude == MAGNITUDE_SQUARED)
+        {
+            squared_magnitude(delta_x, delta_y, rows*cols, magsq);
+            non_max_supp_squared(magsq, delta_x, delta_y, rows, cols, nms, &cand);
+        }
+        else
+        {
+            stages.magnitude_x_y(delta_x, delta_y, rows, cols, magnitude);
+            stages.non_max_supp(magnitude, delta_x, delta_y, rows, cols, nms, &cand);
+        }
+        stopTimer(&nonmax);
+        printTimer(&nonmax);
+
+        free(delta_x);
+        free(delta_y);
+    }
+    else if(options.magnitude == MAGNITUDE_SQUARED)
+    {
+        if(fname != NULL)
+        {
+            stages.derrivative_x_y(smoothedim, rows, cols, &delta_x, &delta_y);
+            write_direction(delta_x, delta_y, rows, cols, fname, &radian);
+            free(delta_x);
+            free(delta_y);
+        }
+
+        startTimer(&gradient);
+        stages.gradient_nms_squared(smoothedim, rows, cols, magsq, nms, &cand);
+        stopTimer(&gradient);
+        printTimer(&gradient);
+    }
+    else if(fname == NULL)
+    {
+        startTimer(&gradient);
+        stages.gradient_nms(smoothedim, rows, cols, magnitude, nms, &cand);
+        stopTimer(&gradient);
+        printTimer(&gradient);
+    }
+    else
+    {
+        /*************************************************************************
+        * Compute the first derivative in the x and y directions.
+        *************************************************************************/
+        startTimer(&derivative);
+        stages.derrivative_x_y(smoothedim, rows, cols, &delta_x, &delta_y);
+        stopTimer(&derivative);
+        printTimer(&derivative);
+
+        /*************************************************************************
+        * Write out the direction of the edge gradient.
+        *************************************************************************/
+        write_direction(delta_x, delta_y, rows, cols, fname, &radian);
+
+        /*************************************************************************
+        * Compute the magnitude of the gradient.
+        *************************************************************************/
+        startTimer(&magnitudeTimer);
+        stages.magnitude_x_y(delta_x, delta_y, rows, cols, magnitude);
+        stopTimer(&magnitudeTimer);
+        printTimer(&magnitudeTimer);
+
+        /*************************************************************************
+        * Perform non-maximal suppression.
+        *************************************************************************/
+        startTimer(&nonmax);
+        stages.non_max_supp(magnitude, delta_x, delta_y, rows, cols, nms, &cand);
+        stopTimer(&nonmax);
+        printTimer(&nonmax);
+
+        free(delta_x);
+        free(delta_y);
+    }
+
+    /****************************************************************************
+    * Use hysteresis to mark the edge pixels.
+    ****************************************************************************/
+    if((*edge=(unsigned char *)malloc(rows*cols*sizeof(unsigned char))) == NULL)
+    {
+        fprintf(stderr, "Error allocating the edge image.\n");
+        exit(1);
+    }
+    startTimer(&hysteresis);
+    if(options.hysteresis == HYSTERESIS_UNION)
+        apply_hysteresis_union(magnitude, magsq, nms, rows, cols, tlow, thigh, *edge, &cand,
+                               options.threads);
+    else if(options.hysteresis == HYSTERESIS_RECONSTRUCT)
+        apply_hysteresis_reconstruct(magnitude, magsq, nms, rows, cols, tlow, thigh, *edge, &cand);
+    else if(options.hysteresis == HYSTERESIS_PACKED)
+        apply_hysteresis_packed(magnitude, magsq, nms, rows, cols, tlow, thigh, &mask, &cand);
+    else if(options.magnitude == MAGNITUDE_SQUARED)
+        stages.apply_hysteresis_squared(magsq, nms, rows, cols, tlow, thigh, *edge, &cand);
+    else
+        stages.apply_hysteresis(magnitude, nms, rows, cols, tlow, thigh, *edge, &cand);
+    stopTimer(&hysteresis);
+    printTimer(&hysteresis);
+
+    /****************************************************************************
+    * HYSTERESIS_PACKED leaves the edges in mask, the other engines in the edge
+    * image. Each is made from the other only for the output that needs it.
+    ****************************************************************************/
+    if(options.hysteresis == HYSTERESIS_PACKED) edge_mask_bytes(&mask, *edge);
+    else if(options.pbm != NULL)
+    {
+        edge_mask_init(&mask, rows, cols);
+        edge_mask_pack(&mask, *edge);
+    }
+    if(options.pbm != NULL) write_edge_pbm(options.pbm, &mask);
+    if(options.subpixel != NULL) write_subpixel(options.subpixel, &cand, *edge, rows, cols);
+
+    free(smoothedim);
+    free(magnitude);
+    free(magsq);
+    free(nms);
+    nms_candidates_free(&cand);
+    edge_mask_free(&mask);
+}
+
+/*******************************************************************************
+* FUNCTION: border_index
+* PURPOSE: Return the pixel a stencil reads for position i of a line of n
+* pixels. Inside the line that is i itself, outside it depends on
+* options.border: the nearest end (BORDER_CLAMP), the reflection about the end
+* pixel (BORDER_MIRROR, repeated for lines shorter than the stencil) or -1
+* when the tap is dropped (BORDER_RENORMALISE and BORDER_ZERO).
+*******************************************************************************/
+int border_index(int i, int n)
+{
+    int period;
+
+    if(i >= 0 && i < n) return i;
+
+    switch(options.border)
+    {
+    case BORDER_CLAMP:
+        return (i < 0) ? 0 : n-1;
+    case BORDER_MIRROR:
+        if(n == 1) return 0;
+        period = 2*(n-1);
+        i %= period;
+        if(i < 0) i += period;
+        return (i < n) ? i : period-i;
+    default:
+        return -1;
+    }
+}
+
+/*******************************************************************************
+* FUNCTION: border_difference
+* PURPOSE: The central difference s[i+1] - s[i-1] for a pixel i at the end of
+* a line of n pixels stride apart. With BORDER_RENORMALISE the missing pixel
+* is replaced by pixel i, which gives the one sided difference of Heath's
+* code, with BORDER_ZERO it reads as 0.
+*******************************************************************************/
+short int border_difference(const short int *s, int i, int n, int stride)
+{
+    int next = border_index(i+1, n), prev = border_index(i-1, n);
+
+    if(options.border == BORDER_RENORMALISE)
+    {
+        if(next < 0) next = i;
+        if(prev < 0) prev = i;
+    }
+    return ((next < 0) ? 0 : s[next*stride]) - ((prev < 0) ? 0 : s[prev*stride]);
+}
+
+/*******************************************************************************
+* FUNCTION: border_row
+* PURPOSE: The row a y-difference of row r reads in place of row i, NULL for
+* a row of zeros. See border_difference.
+*******************************************************************************/
+const short int *border_row(const short int *smoothedim, int i, int r, int rows, int cols)
+{
+    int k = border_index(i, rows);
+
+    if(k < 0 && options.border == BORDER_RENORMALISE) k = r;
+    return (k < 0) ? NULL : &smoothedim[k*cols];
+}
+
+/*******************************************************************************
+* FUNCTION: clamped_border_index
+* PURPOSE: border_index for the derivative of gaussian, which clamps where the
+* border is renormalised: a derivative kernel can not be rescaled to the taps
+* that are left.
+*******************************************************************************/
+int clamped_border_index(int i, int n)
+{
+    int k = border_index(i, n);
+
+    if(k < 0 && options.border == BORDER_RENORMALISE) k = (i < 0) ? 0 : n-1;
+    return k;
+}
+
+/*******************************************************************************
+* FUNCTION: border_dot
+* PURPOSE: One pixel of the x pass of gaussian_smooth whose kernel reaches
+* past the end of the row. The taps are taken through border_index; unless
+* the border is renormalised, the dropped taps still count in the sum.
+*******************************************************************************/
+static float border_dot(const unsigned char *in, int cols, int c, const float *kernel,
+                        int center)
+{
+    int cc, i;
+    float dot = 0.0, sum = 0.0;
+
+    for(cc=(-center); cc<=center; cc++)
+    {
+        i = border_index(c+cc, cols);
+        if(i >= 0) dot += (float)in[i] * kernel[center+cc];
+        if(i >= 0 || options.border != BORDER_RENORMALISE) sum += kernel[center+cc];
+    }
+    return dot/sum;
+}
+
+/*******************************************************************************
+* PROCEDURE: make_gaussian_kernel
+* PURPOSE: Create a one dimensional gaussian kernel.
+* NAME: Mike Heath
+* DATE: 2/15/96
+*******************************************************************************/
+void make_gaussian_kernel(float sigma, float **kernel, int *windowsize)
+{
+    int i, center;
+    float x, fx, sum=0.0;
+
+    *windowsize = 1 + 2 * ceil(2.5 * sigma);
+    center = (*windowsize) / 2;
+
+    if((*kernel = (float *) malloc((*windowsize)* sizeof(float))) == NULL)
+    {
+        fprintf(stderr, "Error callocing the gaussian kernel array.\n");
+        exit(1);
+    }
+
+    for(i=0; i<(*windowsize); i++)
+    {
+        x = (float)(i - center);
+        fx = pow(2.71828, -0.5*x*x/(sigma*sigma)) / (sigma * sqrt(6.2831853));
+        (*kernel)[i] = fx;
+        sum += fx;
+    }
+
+    for(i=0; i<(*windowsize); i++) (*kernel)[i] /= sum;
+
+    if(VERBOSE)
+    {
+        printf("The filter coefficients are:\n");
+        for(i=0; i<(*windowsize); i++)
+            printf("kernel[%d] = %f\n", i, (*kernel)[i]);
+    }
+}
+
+
+/*******************************************************************************
+* PROCEDURE: make_fixed_gaussian_kernel
+* PURPOSE: Create the one dimensional gaussian kernel in the fixed point format
+* of the DSP: every tap is scaled by 2^17 and truncated. For sigma = 2.5 this
+* gives exactly the table in dsp/task.c. The scale is lowered for small sigmas
+* where the centre tap would not fit in 16 bits. Returns the sum of the taps.
+*******************************************************************************/
+unsigned int make_fixed_gaussian_kernel(float sigma, unsigned short int **kernel,
+                                        int *windowsize)
+{
+    int i, shift = 17;
+    float *fkernel;
+    unsigned int sum = 0;
+
+    make_gaussian_kernel(sigma, &fkernel, windowsize);
+
+    if((*kernel = (unsigned short int *) malloc((*windowsize)* sizeof(unsigned short int))) == NULL)
+    {
+        fprintf(stderr, "Error callocing the fixed point gaussian kernel array.\n");
+        exit(1);
+    }
+
+    while(fkernel[(*windowsize)/2] * (1 << shift) > 65535.0) shift--;
+
+    for(i=0; i<(*windowsize); i++)
+    {
+        (*kernel)[i] = (unsigned short int)(fkernel[i] * (1 << shift));
+        sum += (*kernel)[i];
+    }
+
+    free(fkernel);
+    return sum;
+}
+
+/*******************************************************************************
+* FUNCTION: fixed_border_dot
+* PURPOSE: One pixel of the x pass of gaussian_smooth_fixed whose kernel is
+* cut off by the border and renormalised, as on the DSP.
+*******************************************************************************/
+static unsigned char fixed_border_dot(const unsigned char *in, int cols, int c,
+                                      const unsigned short int *kernel, int center)
+{
+    int cc;
+    unsigned int dot = 0, sum = 0;
+
+    for(cc=(-center); cc<=center; cc++)
+    {
+        if(((c+cc) >= 0) && ((c+cc) < cols))
+        {
+            dot += in[c+cc] * kernel[center+cc];
+            sum += kernel[center+cc];
+        }
+    }
+    return dot/sum;
+}
+
+/*******************************************************************************
+* PROCEDURE: gaussian_smooth_fixed
+* PURPOSE: Blur an image with the integer gaussian filter the DSP uses, so the
+* rows smoothed on the GPP and on the DSP match bit for bit. The x pass stores
+* dot/sum truncated to a byte, the y pass computes dot*90/sum in 32 bits.
+* Only the first rows rows are smoothed into a buffer of complete_rows rows.
+* Like the DSP it always renormalises at the border, whatever options.border.
+*******************************************************************************/
+unsigned short int* gaussian_smooth_fixed(unsigned char *image, int rows, int cols,
+                                          float sigma, int complete_rows)
+{
+    int r, c, rr, cc, k0, k1, /* Counter variables. */
+        lo, hi,           /* The columns lo..hi-1 do not reach the border. */
+        windowsize,       /* Dimension of the gaussian kernel. */
+        center;           /* Half of the windowsize. */
+    unsigned int dot,     /* Dot product summing variable. */
+          sum,            /* Sum of the kernel weights variable. */
+          kernelSum;      /* Sum of the whole kernel. */
+    unsigned short int *kernel, *smoothedim;
+    unsigned char *tmp, *in;
+
+    kernelSum = make_fixed_gaussian_kernel(sigma, &kernel, &windowsize);
+    center = windowsize / 2;
+    lo = (center < cols) ? center : cols;
+    hi = (cols-center > lo) ? cols-center : lo;
+
+    if((tmp = (unsigned char *) malloc(rows*cols* sizeof(unsigned char))) == NULL)
+    {
+        fprintf(stderr, "Error allocating the buffer image.\n");
+        exit(1);
+    }
+    if(((smoothedim) = (unsigned short int *) malloc(complete_rows*cols*sizeof(short int))) == NULL)
+    {
+        fprintf(stderr, "Error allocating the smoothed image.\n");
+        exit(1);
+    }
+
+    /****************************************************************************
+    * Blur in the x - direction. Only the first and last center columns need
+    * the kernel to be cut off at the border.
+    ****************************************************************************/
+    for(r=0; r<rows; r++)
+    {
+        in = &image[r*cols];
+        for(c=0; c<lo; c++)
+            tmp[r*cols+c] = fixed_border_dot(in, cols, c, kernel, center);
+        for(; c<hi; c++)
+        {
+            dot = 0;
+            for(cc=(-center); cc<=center; cc++)
+                dot += in[c+cc] * kernel[center+cc];
+            tmp[r*cols+c] = dot/kernelSum;
+        }
+        for(; c<cols; c++)
+            tmp[r*cols+c] = fixed_border_dot(in, cols, c, kernel, center);
+    }
+
+    /****************************************************************************
+    * Blur in the y - direction, a row at a time. The taps k0..k1-1 of the
+    * kernel fall inside the image, so the sum only changes from row to row.
+    ****************************************************************************/
+    for(r=0; r<rows; r++)
+    {
+        k0 = (r < center) ? center-r : 0;
+        k1 = (r+center >= rows) ? rows-r+center : windowsize;
+        sum = 0;
+        for(rr=k0; rr<k1; rr++) sum += kernel[rr];
+
+        in = &tmp[(r-center+k0)*cols];
+        for(c=0; c<cols; c++)
+        {
+            dot = 0;
+            for(rr=k0; rr<k1; rr++)
+                dot += in[(rr-k0)*cols+c] * kernel[rr];
+            smoothedim[r*cols+c] = dot*90/sum;
+        }
+    }
+
+    free(tmp);
+    free(kernel);
+    return smoothedim;
+}
+
+/*******************************************************************************
+* PROCEDURE: gaussian_smooth
+* PURPOSE: Blur an image with a gaussian filter. This is the scalar reference
+* version of gaussian_smooth_neon with the same interface: only the first rows
+* rows are smoothed into a buffer of complete_rows rows. What the kernel reads
+* past the border follows options.border.
+* NAME: Mike Heath
+* DATE: 2/15/96
+*******************************************************************************/
+unsigned short int* gaussian_smooth(unsigned char *image, int rows, int cols, float sigma,
+                                    int complete_rows)
+{
+    int r, c, rr, cc, i, n, /* Counter variables. */
+        lo, hi,            /* The columns lo..hi-1 do not reach the border. */
+        windowsize,        /* Dimension of the gaussian kernel. */
+        center;            /* Half of the windowsize. */
+    float *tempim,        /* Buffer for separable filter gaussian smoothing. */
+          *kernel,        /* A one dimensional gaussian kernel. */
+          **src,          /* The tempim rows under the taps of the y pass. */
+          *weight,        /* The taps that go with them. */
+          dot,            /* Dot product summing variable. */
+          sum;            /* Sum of the kernel weights variable. */
+    unsigned short int *smoothedim;
+
+    /****************************************************************************
+    * Create a 1-dimensional gaussian smoothing kernel.
+    ****************************************************************************/
+    make_gaussian_kernel(sigma, &kernel, &windowsize);
+    center = windowsize / 2;
+    lo = (center < cols) ? center : cols;
+    hi = (cols-center > lo) ? cols-center : lo;
+
+    /****************************************************************************
+    * Allocate a temporary buffer image and the smoothed image.
+    ****************************************************************************/
+    if((tempim = (float *) malloc(rows*cols* sizeof(float))) == NULL)
+    {
+        fprintf(stderr, "Error allocating the buffer image.\n");
+        exit(1);
+    }
+    if(((smoothedim) = (unsigned short int *) malloc(complete_rows*cols*sizeof(short int))) == NULL)
+    {
+        fprintf(stderr, "Error allocating the smoothed image.\n");
+        exit(1);
+    }
+    if(((src = (float **) malloc(windowsize*sizeof(float *))) == NULL) ||
+       ((weight = (float *) malloc(windowsize*sizeof(float))) == NULL))
+    {
+        fprintf(stderr, "Error allocating the tap lists.\n");
+        exit(1);
+    }
+
+    /****************************************************************************
+    * Blur in the x - direction. The first and last center columns go through
+    * border_dot, the columns in between never reach past the row.
+    ****************************************************************************/
+    for(r=0; r<rows; r++)
+    {
+        for(c=0; c<lo; c++)
+            tempim[r*cols+c] = border_dot(&image[r*cols], cols, c, kernel, center);
+        for(; c<hi; c++)
+        {
+            dot = 0.0;
+            sum = 0.0;
+            for(cc=(-center); cc<=center; cc++)
+            {
+                dot += (float)image[r*cols+(c+cc)] * kernel[center+cc];
+                sum += kernel[center+cc];
+            }
+            tempim[r*cols+c] = dot/sum;
+        }
+        for(; c<cols; c++)
+            tempim[r*cols+c] = border_dot(&image[r*cols], cols, c, kernel, center);
+    }
+
+    /****************************************************************************
+    * Blur in the y - direction, a row at a time. Which rows the taps read and
+    * the sum of the taps only depend on the row, so they are worked out once
+    * per row and the loop over the columns has no border tests.
+    ****************************************************************************/
+    for(r=0; r<rows; r++)
+    {
+        n = 0;
+        sum = 0.0;
+        for(rr=(-center); rr<=center; rr++)
+        {
+            i = border_index(r+rr, rows);
+            if(i >= 0)
+            {
+                src[n] = &tempim[i*cols];
+                weight[n++] = kernel[center+rr];
+            }
+            if(i >= 0 || options.border != BORDER_RENORMALISE) sum += kernel[center+rr];
+        }
+
+        for(c=0; c<cols; c++)
+        {
+            dot = 0.0;
+            for(i=0; i<n; i++) dot += src[i][c] * weight[i];
+            smoothedim[r*cols+c] = (unsigned short int)(dot*BOOSTBLURFACTOR/sum + 0.5);
+        }
+    }
+
+    free(weight);
+    free(src);
+    free(tempim);
+    free(kernel);
+    return smoothedim;
+}
+
+/*******************************************************************************
+* PROCEDURE: iir_gaussian_coefficients
+* PURPOSE: Coefficients of the recursive gaussian of Young and van Vliet
+* ("Recursive implementation of the Gaussian filter", Signal Processing 44,
+* 1995). Both the causal and the anti-causal pass compute
+*   w[n] = coef[0]*x[n] + coef[1]*w[n-1] + coef[2]*w[n-2] + coef[3]*w[n-3]
+* The fit is valid for sigma >= 0.5, smaller sigmas are treated as 0.5.
+*******************************************************************************/
+void iir_gaussian_coefficients(float sigma, float coef[4])
+{
+    double q, b0, b1, b2, b3;
+
+    if(sigma < 0.5) sigma = 0.5;
+    if(sigma >= 2.5) q = 0.98711*sigma - 0.96330;
+    else q = 3.97156 - 4.14554*sqrt(1.0 - 0.26891*sigma);
+
+    b0 = 1.57825 + 2.44413*q + 1.4281*q*q + 0.422205*q*q*q;
+    b1 = 2.44413*q + 2.85619*q*q + 1.26661*q*q*q;
+    b2 = -(1.4281*q*q + 1.26661*q*q*q);
+    b3 = 0.422205*q*q*q;
+
+    coef[1] = b1 / b0;
+    coef[2] = b2 / b0;
+    coef[3] = b3 / b0;
+    coef[0] = 1.0 - (coef[1] + coef[2] + coef[3]);
+}
+
+/*******************************************************************************
+* PROCEDURE: get_gaussian_kernel
+* PURPOSE: Return the kernels and normalisation tables for sigma. They are
+* built on first use and kept in a small cache, so the per frame setup of the
+* smoothers is a lookup. The kernels are symmetric, so cut and fixed_cut also
+* give the sums of the last taps. The entries are replaced in turn, a hit
+* included, so the result is only valid until the next call for a sigma that
+* is not cached. The cache is static and not thread-safe.
+*******************************************************************************/
+#define GAUSSIAN_CACHE_SIZE 4
+
+const gaussian_kernel *get_gaussian_kernel(float sigma)
+{
+    static gaussian_kernel cache[GAUSSIAN_CACHE_SIZE];
+    static int used = 0, next = 0;
+    gaussian_kernel *g;
+    int i, k, center;
+    double moment;
+
+    for(i=0; i<used; i++)
+        if(cache[i].sigma == sigma) return &cache[i];
+
+    if(used < GAUSSIAN_CACHE_SIZE) g = &cache[used++];
+    else
+    {
+        g = &cache[next];
+        next = (next + 1) % GAUSSIAN_CACHE_SIZE;
+        free(g->kernel);
+        free(g->cut);
+        free(g->rescale);
+        free(g->fixed);
+        free(g->fixed_cut);
+        free(g->derivative);
+    }
+
+    g->sigma = sigma;
+    make_gaussian_kernel(sigma, &g->kernel, &g->windowsize);
+    g->fixedSum = make_fixed_gaussian_kernel(sigma, &g->fixed, &g->windowsize);
+    g->center = center = g->windowsize / 2;
+    iir_gaussian_coefficients(sigma, g->iir);
+
+    if(((g->cut = (float *) malloc((center+1)*sizeof(float))) == NULL) ||
+       ((g->rescale = (float *) malloc((center+1)*sizeof(float))) == NULL) ||
+       ((g->fixed_cut = (unsigned int *) malloc((center+1)*sizeof(unsigned int))) == NULL) ||
+       ((g->derivative = (float *) malloc(g->windowsize*sizeof(float))) == NULL))
+    {
+        fprintf(stderr, "Error allocating the kernel tables.\n");
+        exit(1);
+    }
+
+    g->kernelSum = 0.0;
+    for(k=0; k<g->windowsize; k++) g->kernelSum += g->kernel[k];
+
+    g->cut[0] = 0.0;
+    g->fixed_cut[0] = 0;
+    for(k=1; k<=center; k++)
+    {
+        g->cut[k] = g->cut[k-1] + g->kernel[k-1];
+        g->fixed_cut[k] = g->fixed_cut[k-1] + g->fixed[k-1];
+    }
+    for(k=0; k<=center; k++)
+        g->rescale[k] = g->kernelSum / (g->kernelSum - g->cut[center-k]);
+
+    /* A unit ramp gives sum((k-center)^2 * kernel[k]) with taps (k-center)*kernel[k]. */
+    moment = 0.0;
+    for(k=0; k<g->windowsize; k++) moment += (k-center)*(k-center)*g->kernel[k];
+    for(k=0; k<g->windowsize; k++)
+        g->derivative[k] = 2.0*BOOSTBLURFACTOR * (k-center)*g->kernel[k] / moment;
+
+    return g;
+}
+
+/*******************************************************************************
+* PROCEDURE: gaussian_smooth_iir
+* PURPOSE: Approximate the gaussian blur with a recursive filter. A causal and
+* an anti-causal third order pass are run along every row and then along
+* every column, so the cost per pixel does not depend on sigma. The border
+* pixels are replicated (the filter starts in the steady state of the edge
+* value) instead of renormalising the kernel as gaussian_smooth does. The
+* interface is the same as that of gaussian_smooth.
+*******************************************************************************/
+unsigned short int* gaussian_smooth_iir(unsigned char *image, int rows, int cols, float sigma,
+                                        int complete_rows)
+{
+    int r, c;
+    float coef[4], w0, w1, w2, w3;
+    float *tempim;
+    unsigned short int *smoothedim;
+
+    iir_gaussian_coefficients(sigma, coef);
+
+    if((tempim = (float *) malloc(rows*cols* sizeof(float))) == NULL)
+    {
+        fprintf(stderr, "Error allocating the buffer image.\n");
+        exit(1);
+    }
+    if(((smoothedim) = (unsigned short int *) malloc(complete_rows*cols*sizeof(short int))) == NULL)
+    {
+        fprintf(stderr, "Error allocating the smoothed image.\n");
+        exit(1);
+    }
+
+    /****************************************************************************
+    * Filter in the x - direction, forwards and then backwards.
+    ****************************************************************************/
+    for(r=0; r<rows; r++)
+    {
+        unsigned char *in = &image[r*cols];
+        float *out = &tempim[r*cols];
+
+        w1 = w2 = w3 = in[0];
+        for(c=0; c<cols; c++)
+        {
+            w0 = coef[0]*in[c] + coef[1]*w1 + coef[2]*w2 + coef[3]*w3;
+            out[c] = w0;
+            w3 = w2; w2 = w1; w1 = w0;
+        }
+        w1 = w2 = w3 = out[cols-1];
+        for(c=cols-1; c>=0; c--)
+        {
+            w0 = coef[0]*out[c] + coef[1]*w1 + coef[2]*w2 + coef[3]*w3;
+            out[c] = w0;
+            w3 = w2; w2 = w1; w1 = w0;
+        }
+    }
+
+    /****************************************************************************
+    * Filter in the y - direction, forwards and then backwards.
+    ****************************************************************************/
+    for(c=0; c<cols; c++)
+    {
+        w1 = w2 = w3 = tempim[c];
+        for(r=0; r<rows; r++)
+        {
+            w0 = coef[0]*tempim[r*cols+c] + coef[1]*w1 + coef[2]*w2 + coef[3]*w3;
+            tempim[r*cols+c] = w0;
+            w3 = w2; w2 = w1; w1 = w0;
+        }
+        w1 = w2 = w3 = tempim[(rows-1)*cols+c];
+        for(r=rows-1; r>=0; r--)
+        {
+            w0 = coef[0]*tempim[r*cols+c] + coef[1]*w1 + coef[2]*w2 + coef[3]*w3;
+            smoothedim[r*cols+c] = (w0 > 0.0) ? (unsigned short int)(w0*BOOSTBLURFACTOR + 0.5) : 0;
+            w3 = w2; w2 = w1; w1 = w0;
+        }
+    }
+
+    free(tempim);
+    return smoothedim;
+}
 
 /*******************************************************************************
 * Procedure: radian_direction
@@ -74,7 +966,8 @@
 *         ydirtag =  1  for  [ 1 0 -1]'
 *
 * The resulting angle is in radians measured counterclockwise from the
-* xdirection. The angle points "up the gradient".
+* xdirection. The angle points "up the gradient". This is the reference the
+* vector radian_direction_<simd> stages are held to, within 1e-4 rad.
 *******************************************************************************/
 void radian_direction(short int *delta_x, short int *delta_y, int rows,
                       int cols, float **dir_radians, int xdirtag, int ydirtag)
@@ -137,10 +1030,31 @@ float angle_radians(float x, float y)
     }
 }
 
+/*******************************************************************************
+* PROCEDURE: octagonal_magnitude
+* PURPOSE: The MAGNITUDE_OCTAGONAL approximation of the length of (dx,dy):
+* max(M, 7/8 M + 17/32 m) with M the larger and m the smaller of |dx| and
+* |dy|. The result is between 2.7% below and 2.4% above the exact length,
+* plus the truncation of the shifts. The vector kernels compute the same value.
+*******************************************************************************/
+short int octagonal_magnitude(short int dx, short int dy)
+{
+    int ax, ay, big, small, oct;
+
+    ax = (dx < 0) ? -dx : dx;
+    ay = (dy < 0) ? -dy : dy;
+    big = (ax > ay) ? ax : ay;
+    small = (ax > ay) ? ay : ax;
+
+    oct = big - (big >> 3) + (small >> 1) + (small >> 5);
+    return (short)((oct > big) ? oct : big);
+}
+
 /*******************************************************************************
 * PROCEDURE: magnitude_x_y
 * PURPOSE: Compute the magnitude of the gradient. This is the square root of
-* the sum of the squared derivative values.
+* the sum of the squared derivative values, or its octagonal approximation
+* when options.magnitude asks for it.
 * NAME: Mike Heath
 * DATE: 2/15/96
 *******************************************************************************/
@@ -149,6 +1063,13 @@ void magnitude_x_y(short int *delta_x, short int *delta_y, int rows, int cols,
 {
     int r, c, pos, sq1, sq2;
 
+    if(options.magnitude == MAGNITUDE_OCTAGONAL)
+    {
+        for(pos=0; pos<rows*cols; pos++)
+            magnitude[pos] = octagonal_magnitude(delta_x[pos], delta_y[pos]);
+        return;
+    }
+
     for(r=0,pos=0; r<rows; r++)
     {
         for(c=0; c<cols; c++,pos++)
@@ -161,6 +1082,133 @@ void magnitude_x_y(short int *delta_x, short int *delta_y, int rows, int cols,
 }
 
 
+/*******************************************************************************
+* PROCEDURE: derivative_row
+* PURPOSE: Row r of the derivatives of derrivative_x_y, into dx and dy, and
+* unless dir is NULL their gradient_octant codes into dir. The first and last
+* pixel of the row and the whole first and last row are taken through
+* border_difference. GRADIENT_SOBEL and GRADIENT_SCHARR go through
+* weighted_derivative_row, every other options.gradient is the central
+* difference.
+*******************************************************************************/
+static void derivative_row(short int *smoothedim, int r, int rows, int cols,
+                           short int *dx, short int *dy, unsigned char *dir)
+{
+    int c;
+    short int *s = &smoothedim[r*cols];
+
+    if(options.gradient == GRADIENT_SOBEL || options.gradient == GRADIENT_SCHARR)
+    {
+        weighted_derivative_row(smoothedim, r, rows, cols, 0, cols, dx, dy);
+        if(dir != NULL)
+        {
+            for(c=0; c<cols; c++)
+                dir[c] = gradient_octant(dx[c], dy[c]);
+        }
+        return;
+    }
+
+    dx[0] = border_difference(s, 0, cols, 1);
+    for(c=1; c<(cols-1); c++)
+        dx[c] = s[c+1] - s[c-1];
+    dx[cols-1] = border_difference(s, cols-1, cols, 1);
+
+    if(r > 0 && r < rows-1)
+    {
+        for(c=0; c<cols; c++)
+            dy[c] = s[c+cols] - s[c-cols];
+    }
+    else
+    {
+        for(c=0; c<cols; c++)
+            dy[c] = border_difference(&smoothedim[c], r, rows, cols);
+    }
+
+    if(dir != NULL)
+    {
+        for(c=0; c<cols; c++)
+            dir[c] = gradient_octant(dx[c], dy[c]);
+    }
+}
+
+/*******************************************************************************
+* FUNCTION: operator_weights
+* PURPOSE: The weights side, middle, side that GRADIENT_SOBEL (1 2 1) and
+* GRADIENT_SCHARR (3 10 3) apply across the central difference. Returns the
+* shift that divides by their sum.
+*******************************************************************************/
+int operator_weights(int *side, int *middle)
+{
+    if(options.gradient == GRADIENT_SCHARR)
+    {
+        *side = 3;
+        *middle = 10;
+        return 4;
+    }
+    *side = 1;
+    *middle = 2;
+    return 2;
+}
+
+/*******************************************************************************
+* FUNCTION: x_difference
+* PURPOSE: The central x-difference at column c of row, 0 for a NULL row.
+*******************************************************************************/
+static int x_difference(const short int *row, int c, int cols)
+{
+    if(row == NULL) return 0;
+    if(c > 0 && c < cols-1) return row[c+1] - row[c-1];
+    return border_difference(row, c, cols, 1);
+}
+
+/*******************************************************************************
+* FUNCTION: y_difference
+* PURPOSE: The central y-difference of row r at column c, which past the end
+* of the row reads the column options.border gives.
+*******************************************************************************/
+static int y_difference(const short int *smoothedim, int c, int r, int rows, int cols)
+{
+    int k = border_index(c, cols);
+
+    if(k < 0 && options.border == BORDER_RENORMALISE) k = (c < 0) ? c+1 : c-1;
+    if(k < 0) return 0;
+    if(r > 0 && r < rows-1) return smoothedim[(r+1)*cols+k] - smoothedim[(r-1)*cols+k];
+    return border_difference(&smoothedim[k], r, rows, cols);
+}
+
+/*******************************************************************************
+* PROCEDURE: weighted_derivative_row
+* PURPOSE: The GRADIENT_SOBEL or GRADIENT_SCHARR derivatives of the columns
+* c0..c1-1 of row r. dx is the central x-difference of the rows above, at
+* and below the row, weighted with operator_weights, dy the central
+* y-difference of the columns left, at and right of the pixel. The weighted
+* sum is divided by the sum of the weights with a rounding arithmetic shift,
+* so the result stays on the scale of the central difference; the vector
+* stages compute the same integers. Rows and columns past the border are
+* read like border_difference reads pixels: the row or column itself where
+* the border is renormalised, zeros for BORDER_ZERO.
+*******************************************************************************/
+void weighted_derivative_row(const short int *smoothedim, int r, int rows, int cols,
+                             int c0, int c1, short int *dx, short int *dy)
+{
+    int c, side, middle, shift, round;
+    const short int *above, *below, *s = &smoothedim[r*cols];
+
+    shift = operator_weights(&side, &middle);
+    round = 1 << (shift-1);
+    above = border_row(smoothedim, r-1, r, rows, cols);
+    below = border_row(smoothedim, r+1, r, rows, cols);
+
+    for(c=c0; c<c1; c++)
+    {
+        dx[c] = (side*(x_difference(above, c, cols) + x_difference(below, c, cols)) +
+                 middle*x_difference(s, c, cols) + round) >> shift;
+        dy[c] = (side*(y_difference(smoothedim, c-1, r, rows, cols) +
+                       y_difference(smoothedim, c+1, r, rows, cols)) +
+                 middle*y_difference(smoothedim, c, r, rows, cols) + round) >> shift;
+    }
+}
+
 /*******************************************************************************
 * PROCEDURE: derrivative_x_y
 * PURPOSE: Compute the first derivative of the image in both the x any y
@@ -176,7 +1224,7 @@ void magnitude_x_y(short int *delta_x, short int *delta_y, int rows, int cols,
 void derrivative_x_y(short int *smoothedim, int rows, int cols,
         short int **delta_x, short int **delta_y)
 {
-   int r, c, pos;
+   int r;
    /****************************************************************************
    * Allocate images to store the derivatives.
    ****************************************************************************/
@@ -191,24 +1239,218 @@ void derrivative_x_y(short int *smoothedim, int rows, int cols,
 	
 
 
+   /****************************************************************************
+   * Both derivatives are computed a row at a time, in one sweep.
+   ****************************************************************************/
    for(r=0;r<rows;r++){
-      pos = r * cols;
-      (*delta_x)[pos] = smoothedim[pos+1] - smoothedim[pos];
-      pos++;
-      for(c=1;c<(cols-1);c++,pos++){
-         (*delta_x)[pos] = smoothedim[pos+1] - smoothedim[pos-1];
-      }
-      (*delta_x)[pos] = smoothedim[pos] - smoothedim[pos-1];
+      derivative_row(smoothedim, r, rows, cols, &(*delta_x)[r*cols], &(*delta_y)[r*cols], NULL);
    }
+}
 
-   for(c=0;c<cols;c++){
-      pos = c;
-      (*delta_y)[pos] = smoothedim[pos+cols] - smoothedim[pos];
-      pos += cols;
-      for(r=1;r<(rows-1);r++,pos+=cols){
-         (*delta_y)[pos] = smoothedim[pos+cols] - smoothedim[pos-cols];
-      }
-      (*delta_y)[pos] = smoothedim[pos] - smoothedim[pos-cols];
-   }
+/*******************************************************************************
+* FUNCTION: derivative_round
+* PURPOSE: A derivative of gaussian value as a short: clamped to
+* DERIVATIVE_LIMIT and rounded half away from zero, like the vector stages do.
+*******************************************************************************/
+short int derivative_round(float v)
+{
+    if(v > DERIVATIVE_LIMIT) v = DERIVATIVE_LIMIT;
+    if(v < -DERIVATIVE_LIMIT) v = -DERIVATIVE_LIMIT;
+    return (short int)(v + ((v < 0.0) ? -0.5 : 0.5));
 }
 
+/*******************************************************************************
+* PROCEDURE: derivative_of_gaussian
+* PURPOSE: The GRADIENT_DOG derivatives, taken from the image itself in two
+* separable passes. The x pass convolves every row with the gaussian and with
+* its derivative, the y pass convolves the first with the derivative into dy
+* and the second with the gaussian into dx. No smoothed image is made; the
+* derivative taps of get_gaussian_kernel put the result on the scale of the
+* central difference of gaussian_smooth. Past the border the image is read
+* through clamped_border_index, a tap it drops still counts in the sum of the
+* gaussian.
+*******************************************************************************/
+void derivative_of_gaussian(unsigned char *image, int rows, int cols, float sigma,
+                            short int **delta_x, short int **delta_y)
+{
+    const gaussian_kernel *g;
+    int r, c, k, i;
+    float *smooth,    /* The rows blurred with the gaussian. */
+          *slope,     /* And convolved with its derivative. */
+          dot, ddot;
+
+    g = get_gaussian_kernel(sigma);
+
+    if(((smooth = (float *) malloc(rows*cols*sizeof(float))) == NULL) ||
+       ((slope = (float *) malloc(rows*cols*sizeof(float))) == NULL))
+    {
+        fprintf(stderr, "Error allocating the buffer images.\n");
+        exit(1);
+    }
+    if((((*delta_x) = (short *) malloc(rows*cols*sizeof(short))) == NULL) ||
+       (((*delta_y) = (short *) malloc(rows*cols*sizeof(short))) == NULL))
+    {
+        fprintf(stderr, "Error allocating the derivative images.\n");
+        exit(1);
+    }
+
+    /****************************************************************************
+    * The x pass, both kernels at once.
+    ****************************************************************************/
+    for(r=0; r<rows; r++)
+    {
+        for(c=0; c<cols; c++)
+        {
+            dot = ddot = 0.0;
+            for(k=0; k<g->windowsize; k++)
+            {
+                i = clamped_border_index(c+k-g->center, cols);
+                if(i < 0) continue;
+                dot += (float)image[r*cols+i] * g->kernel[k];
+                ddot += (float)image[r*cols+i] * g->derivative[k];
+            }
+            smooth[r*cols+c] = dot / g->kernelSum;
+            slope[r*cols+c] = ddot;
+        }
+    }
+
+    /****************************************************************************
+    * The y pass.
+    ****************************************************************************/
+    for(r=0; r<rows; r++)
+    {
+        for(c=0; c<cols; c++)
+        {
+            dot = ddot = 0.0;
+            for(k=0; k<g->windowsize; k++)
+            {
+                i = clamped_border_index(r+k-g->center, rows);
+                if(i < 0) continue;
+                dot += slope[i*cols+c] * g->kernel[k];
+                ddot += smooth[i*cols+c] * g->derivative[k];
+            }
+            (*delta_x)[r*cols+c] = derivative_round(dot / g->kernelSum);
+            (*delta_y)[r*cols+c] = derivative_round(ddot);
+        }
+    }
+
+    free(slope);
+    free(smooth);
+}
+
+/*******************************************************************************
+* PROCEDURE: gradient_nms
+* PURPOSE: derrivative_x_y, magnitude_x_y and non_max_supp in one pass over
+* the rows of the smoothed image. Only two rows of the derivatives, and of the
+* direction codes derivative_row makes for the suppression, are kept:
+* once the magnitude of row r is known, row r-1 has its three magnitude rows
+* and is suppressed. The magnitude image is written as well, hysteresis needs
+* it. Unlike non_max_supp, which leaves them alone, the row nrows-2 and the
+* column ncols-2 are zeroed along with the border of nms. Unless cand is NULL
+* the possible edges of each row are collected into it once it is done.
+*******************************************************************************/
+void gradient_nms(short int *smoothedim, int rows, int cols, short int *magnitude,
+                  unsigned char *nms, nms_candidates *cand)
+{
+    int r, q;
+    short int *dx, *dy;    /* The derivatives of the last two rows. */
+    unsigned char *dir;    /* And their direction codes. */
+    nms_state state = { 0, 0, 0.0, 0.0 };
+
+    if(((dx = (short *) malloc(2*cols*sizeof(short))) == NULL) ||
+       ((dy = (short *) malloc(2*cols*sizeof(short))) == NULL) ||
+       ((dir = (unsigned char *) malloc(2*cols)) == NULL))
+    {
+        fprintf(stderr, "Error allocating the derivative rows.\n");
+        exit(1);
+    }
+
+    for(r=0; r<rows; r++)
+    {
+        derivative_row(smoothedim, r, rows, cols, &dx[(r%2)*cols], &dy[(r%2)*cols],
+                       &dir[(r%2)*cols]);
+        magnitude_x_y(&dx[(r%2)*cols], &dy[(r%2)*cols], 1, cols, &magnitude[r*cols]);
+
+        q = r - 1;
+        if(q < 1 || q >= rows-2) continue;
+        non_max_supp_row(&magnitude[(q-1)*cols], &magnitude[q*cols], &magnitude[(q+1)*cols],
+                         &dx[(q%2)*cols], &dy[(q%2)*cols], &dir[(q%2)*cols], cols,
+                         &nms[q*cols], &state);
+        if(cand != NULL)
+        {
+            nms_collect_row(nms, magnitude, NULL, q*cols+1, cols-3, cand);
+            nms_subpixel_row(magnitude, NULL, &dx[(q%2)*cols], &dy[(q%2)*cols], cols, cand);
+        }
+    }
+
+    clear_nms_border(nms, rows, cols);
+
+    free(dir);
+    free(dy);
+    free(dx);
+}
+
+/*******************************************************************************
+* PROCEDURE: squared_magnitude
+* PURPOSE: magsq = dx*dx + dy*dy for n pixels, summed in float like
+* magnitude_x_y does so that its rounded square root is exactly the magnitude.
+*******************************************************************************/
+void squared_magnitude(const short int *delta_x, const short int *delta_y, int n, int *magsq)
+{
+    int pos, sq1, sq2;
+
+    for(pos=0; pos<n; pos++)
+    {
+        sq1 = (int)delta_x[pos] * (int)delta_x[pos];
+        sq2 = (int)delta_y[pos] * (int)delta_y[pos];
+        magsq[pos] = (int)((float)sq1 + (float)sq2);
+    }
+}
+
+/*******************************************************************************
+* PROCEDURE: gradient_nms_squared
+* PURPOSE: gradient_nms for MAGNITUDE_SQUARED: magsq gets dx*dx + dy*dy from
+* squared_magnitude and the rows are suppressed with
+* non_max_supp_row_squared.
+* No square root is taken. The candidates are collected like gradient_nms
+* does, with squared magnitudes.
+*******************************************************************************/
+void gradient_nms_squared(short int *smoothedim, int rows, int cols, int *magsq,
+                          unsigned char *nms, nms_candidates *cand)
+{
+    int r, q;
+    short int *dx, *dy;    /* The derivatives of the last two rows. */
+    unsigned char *dir;    /* And their direction codes. */
+
+    if(((dx = (short *) malloc(2*cols*sizeof(short))) == NULL) ||
+       ((dy = (short *) malloc(2*cols*sizeof(short))) == NULL) ||
+       ((dir = (unsigned char *) malloc(2*cols)) == NULL))
+    {
+        fprintf(stderr, "Error allocating the derivative rows.\n");
+        exit(1);
+    }
+
+    for(r=0; r<rows; r++)
+    {
+        derivative_row(smoothedim, r, rows, cols, &dx[(r%2)*cols], &dy[(r%2)*cols],
+                       &dir[(r%2)*cols]);
+        squared_magnitude(&dx[(r%2)*cols], &dy[(r%2)*cols], cols, &magsq[r*cols]);
+
+        q = r - 1;
+        if(q < 1 || q >= rows-2) continue;
+        non_max_supp_row_squared(&magsq[(q-1)*cols], &magsq[q*cols], &magsq[(q+1)*cols],
+                                 &dx[(q%2)*cols], &dy[(q%2)*cols], &dir[(q%2)*cols], cols,
+                                 &nms[q*cols]);
+        if(cand != NULL)
+        {
+            nms_collect_row(nms, NULL, magsq, q*cols+1, cols-3, cand);
+            nms_subpixel_row(NULL, magsq, &dx[(q%2)*cols], &dy[(q%2)*cols], cols, cand);
+        }
+    }
+
+    clear_nms_border(nms, rows, cols);
+
+    free(dir);
+    free(dy);
+    free(dx);
+}
@@ -1,19 +1,70 @@
 #ifndef CANNY_H
 #define CANNY_H
 
+#include "hysteresis.h"
+
+/* Everything the smoothers need for one sigma, see get_gaussian_kernel(). */
+typedef struct
+{
+    float sigma;
+    int windowsize, center;
+    float *kernel;                /* The float taps, they sum to kernelSum. */
+    float kernelSum;
+    float *cut;                   /* cut[i]: sum of the first (or last) i taps. */
+    float *rescale;               /* rescale[d]: kernelSum / the sum of the taps
+                                     that fit d pixels from one border. */
+    unsigned short int *fixed;    /* The taps in the fixed point format of the DSP. */
+    unsigned int fixedSum;
+    unsigned int *fixed_cut;      /* fixed_cut[i]: sum of the first i fixed taps. */
+    float iir[4];                 /* Recursive filter coefficients. */
+    float *derivative;            /* The derivative of the gaussian, scaled so that
+                                     it maps a unit ramp to 2*BOOSTBLURFACTOR,
+                                     what the central difference of the smoothed
+                                     ramp is. Used by GRADIENT_DOG. */
+} gaussian_kernel;
+
+/* The largest central difference of a smoothed image, 255*BOOSTBLURFACTOR.
+ * The derivative of gaussian is clamped to it. */
+#define DERIVATIVE_LIMIT 22950
+
 void canny(unsigned char *image, int rows, int cols, float sigma,
            float tlow, float thigh, unsigned char **edge, char *fname);
+void write_subpixel(const char *fname, const nms_candidates *cand, const unsigned char *edge,
+                    int rows, int cols);
+void write_edge_pbm(const char *fname, const edge_mask *mask);
+int border_index(int i, int n);
+short int border_difference(const short int *s, int i, int n, int stride);
+const short int *border_row(const short int *smoothedim, int i, int r, int rows, int cols);
+int clamped_border_index(int i, int n);
+void make_gaussian_kernel(float sigma, float **kernel, int *windowsize);
+unsigned short int* gaussian_smooth(unsigned char *image, int rows, int cols, float sigma,
+                                    int complete_rows);
+void iir_gaussian_coefficients(float sigma, float coef[4]);
+const gaussian_kernel *get_gaussian_kernel(float sigma);
+unsigned short int* gaussian_smooth_iir(unsigned char *image, int rows, int cols, float sigma,
+                                        int complete_rows);
+unsigned int make_fixed_gaussian_kernel(float sigma, unsigned short int **kernel,
+                                        int *windowsize);
+unsigned short int* gaussian_smooth_fixed(unsigned char *image, int rows, int cols,
+                                          float sigma, int complete_rows);
 void derrivative_x_y(short int *smoothedim, int rows, int cols,
         short int **delta_x, short int **delta_y);
+int operator_weights(int *side, int *middle);
+void weighted_derivative_row(const short int *smoothedim, int r, int rows, int cols,
+                             int c0, int c1, short int *dx, short int *dy);
+void derivative_of_gaussian(unsigned char *image, int rows, int cols, float sigma,
+                            short int **delta_x, short int **delta_y);
+short int derivative_round(float v);
+short int octagonal_magnitude(short int dx, short int dy);
 void magnitude_x_y(short int *delta_x, short int *delta_y, int rows, int cols,
                    short int *magnitude);
-void apply_hysteresis(short int *mag, unsigned char *nms, int rows, int cols,
-                      float tlow, float thigh, unsigned char *edge);
+void squared_magnitude(const short int *delta_x, const short int *delta_y, int n, int *magsq);
+void gradient_nms(short int *smoothedim, int rows, int cols, short int *magnitude,
+                  unsigned char *nms, nms_candidates *cand);
+void gradient_nms_squared(short int *smoothedim, int rows, int cols, int *magsq,
+                          unsigned char *nms, nms_candidates *cand);
 void radian_direction(short int *delta_x, short int *delta_y, int rows,
                       int cols, float **dir_radians, int xdirtag, int ydirtag);
 float angle_radians(float x, float y);
-
-void non_max_supp(short *mag, short *gradx, short *grady, int nrows,
-                  int ncols, unsigned char *result);
 #endif /* CANNY_H */
 
@@ -0,0 +1,190 @@
+/*******************************************************************************
+* FILE: dispatch.c
+* PURPOSE: Run-time selection of the Canny stage variants. The CPU features
+* are read from the auxiliary vector (HWCAP) on ARM and with CPUID on x86.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dispatch.h"
+#include "canny_edge.h"
+#include "hysteresis.h"
+#include "neon.h"
+
+#if defined(__i386__) || defined(__x86_64__)
+#define DISPATCH_X86
+#include <cpuid.h>
+#elif defined(__arm__) || defined(__aarch64__)
+#define DISPATCH_ARM
+#endif
+
+#define AT_HWCAP_TAG 16         /* AT_HWCAP from <elf.h> */
+#define HWCAP_ARM_NEON (1 << 12)
+
+canny_stages stages;
+canny_options options = { SMOOTH_FLOAT, 0.0, BORDER_RENORMALISE, MAGNITUDE_EXACT,
+                          GRADIENT_CENTRAL, HYSTERESIS_TRACE, 0, NULL, NULL };
+
+/* The scalar gaussian_smooth stands in for the streaming variant. */
+static const canny_stages scalar_stages = {
+    "scalar", gaussian_smooth, gaussian_smooth, gaussian_smooth_iir, gaussian_smooth_fixed,
+    derrivative_x_y, derivative_of_gaussian, magnitude_x_y, radian_direction,
+    non_max_supp, gradient_nms, gradient_nms_squared,
+    apply_hysteresis, apply_hysteresis_squared
+};
+
+#if defined(DISPATCH_ARM)
+static const canny_stages neon_stages = {
+    "neon", gaussian_smooth_neon, gaussian_smooth_stream_neon,
+    gaussian_smooth_iir_neon, gaussian_smooth_fixed_neon,
+    derrivative_x_y_neon, derivative_of_gaussian_neon,
+    magnitude_x_y_neon, radian_direction_neon,
+    non_max_supp_neon, gradient_nms_neon, gradient_nms_squared_neon,
+    apply_hysteresis, apply_hysteresis_squared
+};
+#endif
+
+#if defined(DISPATCH_X86)
+static const canny_stages sse2_stages = {
+    "sse2", gaussian_smooth_sse2, gaussian_smooth_stream_sse2,
+    gaussian_smooth_iir_sse2, gaussian_smooth_fixed_sse2,
+    derrivative_x_y_sse2, derivative_of_gaussian_sse2,
+    magnitude_x_y_sse2, radian_direction_sse2,
+    non_max_supp_sse2, gradient_nms_sse2, gradient_nms_squared_sse2,
+    apply_hysteresis, apply_hysteresis_squared
+};
+
+static const canny_stages avx2_stages = {
+    "avx2", gaussian_smooth_avx2, gaussian_smooth_stream_avx2,
+    gaussian_smooth_iir_avx2, gaussian_smooth_fixed_avx2,
+    derrivative_x_y_avx2, derivative_of_gaussian_avx2,
+    magnitude_x_y_avx2, radian_direction_avx2,
+    non_max_supp_avx2, gradient_nms_avx2, gradient_nms_squared_avx2,
+    apply_hysteresis, apply_hysteresis_squared
+};
+#endif
+
+/*******************************************************************************
+* FUNCTION: cpu_has
+* PURPOSE: Return 1 when the CPU can run the named variant.
+*******************************************************************************/
+static int cpu_has(const char *name)
+{
+    if(strcmp(name, "scalar") == 0) return 1;
+
+#if defined(DISPATCH_ARM)
+    if(strcmp(name, "neon") == 0)
+    {
+#if defined(__aarch64__)
+        return 1;
+#else
+        /* The auxv is read directly, the toolchain's libc has no getauxval. */
+        unsigned long entry[2];
+        int found = 0;
+        FILE *fp;
+
+        if((fp = fopen("/proc/self/auxv", "rb")) == NULL) return 0;
+        while(fread(entry, sizeof(entry), 1, fp) == 1)
+        {
+            if(entry[0] == AT_HWCAP_TAG)
+            {
+                found = (entry[1] & HWCAP_ARM_NEON) != 0;
+                break;
+            }
+        }
+        fclose(fp);
+        return found;
+#endif
+    }
+#endif
+
+#if defined(DISPATCH_X86)
+    {
+        unsigned int eax, ebx, ecx, edx, xcr0_lo, xcr0_hi;
+
+        if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return 0;
+        if(strcmp(name, "sse2") == 0) return (edx & bit_SSE2) != 0;
+        if(strcmp(name, "avx2") == 0)
+        {
+            /* The OS must save the YMM registers (OSXSAVE and XCR0 bits 1,2). */
+            if(!(ecx & bit_OSXSAVE) || !(ecx & bit_AVX)) return 0;
+            __asm__ ("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+            if((xcr0_lo & 6) != 6) return 0;
+            if(__get_cpuid_max(0, NULL) < 7) return 0;
+            __cpuid_count(7, 0, eax, ebx, ecx, edx);
+            return (ebx & bit_AVX2) != 0;
+        }
+    }
+#endif
+
+    return 0;
+}
+
+/*******************************************************************************
+* FUNCTION: select_smoother
+* PURPOSE: Map options.smooth and options.iir_sigma to a stage, see dispatch.h.
+*******************************************************************************/
+smooth_fn select_smoother(float sigma)
+{
+    switch(options.smooth)
+    {
+    case SMOOTH_FIXED:
+        return stages.gaussian_smooth_fixed;
+    case SMOOTH_IIR:
+        return stages.gaussian_smooth_iir;
+    case SMOOTH_STREAM:
+        if(options.iir_sigma > 0 && sigma >= options.iir_sigma) return stages.gaussian_smooth_iir;
+        return stages.gaussian_smooth_stream;
+    default:
+        if(options.iir_sigma > 0 && sigma >= options.iir_sigma) return stages.gaussian_smooth_iir;
+        return stages.gaussian_smooth;
+    }
+}
+
+/*******************************************************************************
+* PROCEDURE: dispatch_init
+* PURPOSE: Fill the stages table, see dispatch.h.
+*******************************************************************************/
+const char *dispatch_init(const char *force)
+{
+    /* All variants built into this binary, fastest first. */
+    static const canny_stages *variants[] = {
+#if defined(DISPATCH_X86)
+        &avx2_stages, &sse2_stages,
+#endif
+#if defined(DISPATCH_ARM)
+        &neon_stages,
+#endif
+        &scalar_stages
+    };
+    int i, n = sizeof(variants) / sizeof(variants[0]);
+
+    if(force == NULL) force = getenv("CANNY_SIMD");
+
+    stages = scalar_stages;
+    for(i=0; i<n; i++)
+    {
+        if(cpu_has(variants[i]->name))
+        {
+            stages = *variants[i];
+            break;
+        }
+    }
+
+    if(force != NULL && *force != '\0')
+    {
+        for(i=0; i<n; i++)
+            if(strcmp(force, variants[i]->name) == 0) break;
+
+        if(i == n)
+            fprintf(stderr, "Unknown kernel variant %s, using %s.\n", force, stages.name);
+        else if(!cpu_has(variants[i]->name))
+            fprintf(stderr, "The CPU does not support %s, using %s.\n", force, stages.name);
+        else
+            stages = *variants[i];
+    }
+
+    return stages.name;
+}
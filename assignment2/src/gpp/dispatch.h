@@ -0,0 +1,151 @@
+#ifndef DISPATCH_H
+#define DISPATCH_H
+
+#include "hysteresis.h"
+
+/*******************************************************************************
+* The Canny stages are called through this table. dispatch_init() fills it
+* with the fastest variant the CPU supports (NEON on ARM, AVX2 or SSE2 on x86,
+* the scalar reference code otherwise).
+*******************************************************************************/
+typedef unsigned short int* (*smooth_fn)(unsigned char *image, int rows, int cols,
+                                         float sigma, int complete_rows);
+
+typedef struct
+{
+    const char *name;
+    smooth_fn gaussian_smooth;
+    smooth_fn gaussian_smooth_stream;
+    smooth_fn gaussian_smooth_iir;
+    smooth_fn gaussian_smooth_fixed;
+    void (*derrivative_x_y)(short int *smoothedim, int rows, int cols,
+                            short int **delta_x, short int **delta_y);
+    void (*derivative_of_gaussian)(unsigned char *image, int rows, int cols, float sigma,
+                                   short int **delta_x, short int **delta_y);
+    void (*magnitude_x_y)(short int *delta_x, short int *delta_y, int rows, int cols,
+                          short int *magnitude);
+    void (*radian_direction)(short int *delta_x, short int *delta_y, int rows, int cols,
+                             float **dir_radians, int xdirtag, int ydirtag);
+    void (*non_max_supp)(short *mag, short *gradx, short *grady, int nrows,
+                         int ncols, unsigned char *result, nms_candidates *cand);
+    void (*gradient_nms)(short int *smoothedim, int rows, int cols, short int *magnitude,
+                         unsigned char *nms, nms_candidates *cand);
+    void (*gradient_nms_squared)(short int *smoothedim, int rows, int cols, int *magsq,
+                                 unsigned char *nms, nms_candidates *cand);
+    void (*apply_hysteresis)(short int *mag, unsigned char *nms, int rows, int cols,
+                             float tlow, float thigh, unsigned char *edge,
+                             const nms_candidates *cand);
+    void (*apply_hysteresis_squared)(int *magsq, unsigned char *nms, int rows, int cols,
+                                     float tlow, float thigh, unsigned char *edge,
+                                     const nms_candidates *cand);
+} canny_stages;
+
+extern canny_stages stages;
+
+/*******************************************************************************
+* Pipeline options that are not tied to a kernel variant.
+*
+*   smooth  SMOOTH_FLOAT: Heath's floating point gaussian (the default).
+*           SMOOTH_STREAM: the same filter computed with a ring of row
+*           buffers instead of full size intermediate images.
+*           SMOOTH_IIR: a recursive approximation of the gaussian whose cost
+*           does not grow with sigma.
+*           SMOOTH_FIXED: the integer gaussian of the DSP; pool_notify always
+*           uses it so the GPP and DSP parts of the image match exactly.
+*
+*   iir_sigma  SMOOTH_FLOAT and SMOOTH_STREAM switch to SMOOTH_IIR for sigmas
+*           of at least iir_sigma, where the FIR kernels get long. 0, the
+*           default, never switches: the recursive filter only approximates
+*           the gaussian and clamps the border, which moves many edges.
+*
+*   border  What the stencils read outside the image, see border_index().
+*           BORDER_RENORMALISE: the taps that fall outside are dropped and
+*           the gaussian is rescaled to the taps that are left; the
+*           derivative becomes a one sided difference (the default).
+*           BORDER_CLAMP: the nearest edge pixel is repeated.
+*           BORDER_MIRROR: the image is reflected about its edge pixels.
+*           BORDER_ZERO: the image is surrounded by zeros.
+*           The fixed point gaussian always renormalises, like the DSP, and
+*           the recursive one always clamps.
+*
+*   magnitude  MAGNITUDE_EXACT: the square root of dx*dx + dy*dy rounded to
+*           the nearest integer (the default).
+*           MAGNITUDE_OCTAGONAL: max(M, 7/8 M + 17/32 m) of the larger (M)
+*           and smaller (m) of |dx| and |dy|, an octagon within 3% of the
+*           exact length that needs no square root or multiplies.
+*           MAGNITUDE_SQUARED: dx*dx + dy*dy is carried through the
+*           non-maximal suppression and the hysteresis instead, see
+*           gradient_nms_squared. The thresholds are exact, the suppression
+*           interpolates the squares and can differ at near ties.
+*
+*   gradient  GRADIENT_CENTRAL: Heath's [-1 0 1] difference of the smoothed
+*           image (the default).
+*           GRADIENT_SOBEL, GRADIENT_SCHARR: the same difference weighted
+*           1:2:1 or 3:10:3 across it, divided by the sum of the weights so
+*           the values keep the scale of the central difference.
+*           GRADIENT_DOG: separable derivative of gaussian filters applied to
+*           the image itself, no smoothed image is made. Where options.border
+*           renormalises it clamps. pool_notify, whose gaussian is split with
+*           the DSP, uses the central difference instead.
+*
+*   hysteresis  HYSTERESIS_TRACE: Heath's tracing of each edge from its
+*           strongest pixels (the default).
+*           HYSTERESIS_UNION: the edges are labelled as connected components
+*           in strips of rows in parallel, see apply_hysteresis_union.
+*           HYSTERESIS_RECONSTRUCT: the strong pixels are dilated within the
+*           weak ones on rows packed to bits, see
+*           apply_hysteresis_reconstruct. Fast on dense edges.
+*           HYSTERESIS_PACKED: the tracing on a plane of two bits a pixel,
+*           into an edge mask of one bit a pixel, see
+*           apply_hysteresis_packed. The edge image is made from the mask.
+*           The edge image is the same for all four.
+*
+*   threads  The threads of HYSTERESIS_UNION, 0 (the default) for one per CPU.
+*
+*   subpixel  NULL, or the file the sub-pixel positions of the edges are
+*           written to, see write_subpixel(). They are fitted during the
+*           non-maximal suppression.
+*
+*   pbm     NULL, or the file the edges are also written to as a PBM bitmap,
+*           see write_edge_pbm().
+*******************************************************************************/
+typedef enum { SMOOTH_FLOAT, SMOOTH_STREAM, SMOOTH_IIR, SMOOTH_FIXED } smooth_mode;
+
+typedef enum { BORDER_RENORMALISE, BORDER_CLAMP, BORDER_MIRROR, BORDER_ZERO } border_mode;
+
+typedef enum { MAGNITUDE_EXACT, MAGNITUDE_OCTAGONAL, MAGNITUDE_SQUARED } magnitude_mode;
+
+typedef enum { GRADIENT_CENTRAL, GRADIENT_SOBEL, GRADIENT_SCHARR, GRADIENT_DOG } gradient_mode;
+
+typedef enum { HYSTERESIS_TRACE, HYSTERESIS_UNION, HYSTERESIS_RECONSTRUCT,
+               HYSTERESIS_PACKED } hysteresis_mode;
+
+typedef struct
+{
+    smooth_mode smooth;
+    float iir_sigma;
+    border_mode border;
+    magnitude_mode magnitude;
+    gradient_mode gradient;
+    hysteresis_mode hysteresis;
+    int threads;
+    const char *subpixel;
+    const char *pbm;
+} canny_options;
+
+extern canny_options options;
+
+/*******************************************************************************
+* Return the gaussian stage that options select for sigma.
+*******************************************************************************/
+smooth_fn select_smoother(float sigma);
+
+/*******************************************************************************
+* Select the stage variants. force names a variant ("scalar", "neon", "sse2",
+* "avx2") to use instead of the detected one; when it is NULL the CANNY_SIMD
+* environment variable is used. A forced variant the CPU (or the build) does
+* not support is ignored with a warning. Returns the name of the variant.
+*******************************************************************************/
+const char *dispatch_init(const char *force);
+
+#endif /* DISPATCH_H */
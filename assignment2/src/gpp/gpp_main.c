@@ -7,6 +7,7 @@
 
 /*  ----------------------------------- Application Header            */
 #include <pool_notify.h>
+#include "dispatch.h"
 
 /** ============================================================================
  *  @func   main
@@ -21,15 +22,18 @@ int main (int argc, char ** argv)
     Char8 * dspExecutable    = NULL ;
     Char8 * infilename    = NULL ;
 
-    if (argc != 3) {
+    if (argc != 3 && argc != 4) {
         printf ("Usage : %s <absolute path of DSP executable> "
-           "<Buffer Size> <number of transfers>\n",
+           "<input image> [scalar|neon]\n",
            argv [0]) ;
     }
     else {
         dspExecutable    = argv [1] ;
         infilename    = argv [2] ;
 
+        printf ("Using the %s kernels\n",
+                dispatch_init ((argc == 4) ? argv [3] : NULL)) ;
+
         pool_notify_Main (dspExecutable,
                           infilename) ;
     }
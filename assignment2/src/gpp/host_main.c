@@ -0,0 +1,154 @@
+/*******************************************************************************
+* FILE: host_main.c
+* PURPOSE: Stand-alone driver that runs the whole Canny pipeline on the GPP,
+* without DSP/Link. It is built with makefile.host so the vectorised kernels
+* can be run and timed on x86 machines as well as on the board.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pgm_io.h"
+#include "canny_edge.h"
+#include "dispatch.h"
+#include "Timer.h"
+
+int main(int argc, char *argv[])
+{
+    char *infilename = NULL;  /* Name of the input image */
+    char *dirfilename = NULL; /* Name of the output gradient direction image */
+    char outfilename[128];    /* Name of the output "edge" image */
+    char composedfname[128];  /* Name of the output "direction" image */
+    unsigned char *image;     /* The input image */
+    unsigned char *edge;      /* The output edge image */
+    int rows, cols;           /* The dimensions of the image. */
+    float sigma=2.5,          /* Standard deviation of the gaussian kernel. */
+          tlow=0.5,           /* Fraction of the high threshold in hysteresis. */
+          thigh=0.5;          /* High hysteresis threshold control. */
+    char *simd = NULL;        /* Kernel variant forced on the command line. */
+    Timer totalTime;
+
+    /****************************************************************************
+    * Get the command line arguments. Options come before the image name.
+    ****************************************************************************/
+    while(argc > 1 && strncmp(argv[1], "--", 2) == 0)
+    {
+        if(strncmp(argv[1], "--simd=", 7) == 0) simd = argv[1] + 7;
+        else if(strcmp(argv[1], "--smooth=float") == 0) options.smooth = SMOOTH_FLOAT;
+        else if(strcmp(argv[1], "--smooth=stream") == 0) options.smooth = SMOOTH_STREAM;
+        else if(strcmp(argv[1], "--smooth=iir") == 0) options.smooth = SMOOTH_IIR;
+        else if(strcmp(argv[1], "--smooth=fixed") == 0) options.smooth = SMOOTH_FIXED;
+        else if(strncmp(argv[1], "--iir-sigma=", 12) == 0) options.iir_sigma = atof(argv[1] + 12);
+        else if(strcmp(argv[1], "--border=renormalise") == 0) options.border = BORDER_RENORMALISE;
+        else if(strcmp(argv[1], "--border=clamp") == 0) options.border = BORDER_CLAMP;
+        else if(strcmp(argv[1], "--border=mirror") == 0) options.border = BORDER_MIRROR;
+        else if(strcmp(argv[1], "--border=zero") == 0) options.border = BORDER_ZERO;
+        else if(strcmp(argv[1], "--magnitude=exact") == 0) options.magnitude = MAGNITUDE_EXACT;
+        else if(strcmp(argv[1], "--magnitude=octagonal") == 0) options.magnitude = MAGNITUDE_OCTAGONAL;
+        else if(strcmp(argv[1], "--magnitude=squared") == 0) options.magnitude = MAGNITUDE_SQUARED;
+        else if(strcmp(argv[1], "--gradient=central") == 0) options.gradient = GRADIENT_CENTRAL;
+        else if(strcmp(argv[1], "--gradient=sobel") == 0) options.gradient = GRADIENT_SOBEL;
+        else if(strcmp(argv[1], "--gradient=scharr") == 0) options.gradient = GRADIENT_SCHARR;
+        else if(strcmp(argv[1], "--gradient=dog") == 0) options.gradient = GRADIENT_DOG;
+        else if(strcmp(argv[1], "--hysteresis=trace") == 0) options.hysteresis = HYSTERESIS_TRACE;
+        else if(strcmp(argv[1], "--hysteresis=union") == 0) options.hysteresis = HYSTERESIS_UNION;
+        else if(strcmp(argv[1], "--hysteresis=reconstruct") == 0)
+            options.hysteresis = HYSTERESIS_RECONSTRUCT;
+        else if(strcmp(argv[1], "--hysteresis=packed") == 0) options.hysteresis = HYSTERESIS_PACKED;
+        else if(strncmp(argv[1], "--threads=", 10) == 0) options.threads = atoi(argv[1] + 10);
+        else if(strncmp(argv[1], "--subpixel=", 11) == 0) options.subpixel = argv[1] + 11;
+        else if(strncmp(argv[1], "--pbm=", 6) == 0) options.pbm = argv[1] + 6;
+        else fprintf(stderr, "Ignoring unknown option %s.\n", argv[1]);
+        argc--;
+        argv++;
+    }
+
+    if(argc < 2)
+    {
+        fprintf(stderr,"\n<USAGE> %s [--simd=variant] [--smooth=mode] [--iir-sigma=s]\n",argv[0]);
+        fprintf(stderr,"            [--border=border] [--magnitude=magnitude] [--gradient=op]\n");
+        fprintf(stderr,"            [--hysteresis=engine] [--threads=n] [--subpixel=file]\n");
+        fprintf(stderr,"            [--pbm=bitmap]\n");
+        fprintf(stderr,"            image [sigma tlow thigh [writedirim]]\n");
+        fprintf(stderr,"\n      variant:    scalar, neon, sse2 or avx2. The default is ");
+        fprintf(stderr,"the fastest one\n                  the CPU supports, or $CANNY_SIMD.\n");
+        fprintf(stderr,"\n      mode:       float (default), stream (float with row ");
+        fprintf(stderr,"buffers), iir (recursive)\n                  or fixed, the integer ");
+        fprintf(stderr,"gaussian of the DSP.\n");
+        fprintf(stderr,"\n      s:          float and stream use iir from this sigma on, ");
+        fprintf(stderr,"0 never (the default).\n");
+        fprintf(stderr,"\n      border:     renormalise (default), clamp, mirror or zero: ");
+        fprintf(stderr,"what the filters\n                  read past the image border.\n");
+        fprintf(stderr,"\n      magnitude:  exact (default), octagonal, a faster ");
+        fprintf(stderr,"approximation\n                  of the gradient length, or squared, ");
+        fprintf(stderr,"no square roots at all.\n");
+        fprintf(stderr,"\n      op:         central (default), sobel or scharr differences ");
+        fprintf(stderr,"of the smoothed\n                  image, or dog, derivative of ");
+        fprintf(stderr,"gaussian filters on the image.\n");
+        fprintf(stderr,"\n      engine:     trace (default), union, connected components ");
+        fprintf(stderr,"labelled\n                  in n threads, one per CPU by default, ");
+        fprintf(stderr,"or reconstruct,\n                  a dilation on bit rows, ");
+        fprintf(stderr,"or packed, the tracing on\n                  two bits a pixel.\n");
+        fprintf(stderr,"\n      file:       Write the sub-pixel positions of the edges ");
+        fprintf(stderr,"to this file.\n");
+        fprintf(stderr,"\n      bitmap:     Write the edges to this file as a PBM ");
+        fprintf(stderr,"bitmap as well.\n");
+        fprintf(stderr,"\n      image:      An image to process. Must be in ");
+        fprintf(stderr,"PGM format.\n");
+        exit(1);
+    }
+    printf("Using the %s kernels.\n", dispatch_init(simd));
+
+    infilename = argv[1];
+    if(argc >= 5)
+    {
+        sigma = atof(argv[2]);
+        tlow = atof(argv[3]);
+        thigh = atof(argv[4]);
+    }
+    if(argc >= 6) dirfilename = infilename;
+
+    /****************************************************************************
+    * Read in the image. This read function allocates memory for the image.
+    ****************************************************************************/
+    if(read_pgm_image(infilename, &image, &rows, &cols) == 0)
+    {
+        fprintf(stderr, "Error reading the input image, %s.\n", infilename);
+        exit(1);
+    }
+    printf("rows: %d,  cols: %d \n", rows, cols);
+
+    if(dirfilename != NULL)
+    {
+        sprintf(composedfname, "%s_s_%3.2f_l_%3.2f_h_%3.2f.fim", infilename,
+                sigma, tlow, thigh);
+        dirfilename = composedfname;
+    }
+
+    /****************************************************************************
+    * Perform the edge detection. All of the work takes place here.
+    ****************************************************************************/
+    initTimer(&totalTime, "Total Time");
+    startTimer(&totalTime);
+    canny(image, rows, cols, sigma, tlow, thigh, &edge, dirfilename);
+    stopTimer(&totalTime);
+    printTimer(&totalTime);
+
+    /****************************************************************************
+    * Write out the edge image to a file.
+    ****************************************************************************/
+    strcpy(outfilename, infilename);
+    outfilename[strlen(outfilename)-4] = 0;
+    strcat(outfilename, "_out.pgm");
+    printf("Writing the edge iname in the file %s \n", outfilename);
+    if(write_pgm_image(outfilename, edge, rows, cols, "", 255) == 0)
+    {
+        fprintf(stderr, "Error writing the edge image, %s.\n", outfilename);
+        exit(1);
+    }
+
+    free(image);
+    free(edge);
+    return 0;
+}
@@ -6,105 +6,319 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
 #include "hysteresis.h"
 
-#define NOEDGE 255
-#define POSSIBLE_EDGE 128
-#define EDGE 0
-
 /*******************************************************************************
 * PROCEDURE: follow_edges
-* PURPOSE: This procedure edges is a recursive routine that traces edgs along
-* all paths whose magnitude values remain above some specifyable lower
-* threshhold.
+* PURPOSE: This procedure traces edges along all paths from the edge pixel pos
+* whose magnitude values remain above some specifyable lower threshhold. It
+* used to recurse once per edge pixel, which overflowed the stack on long
+* edges; the pixels still to visit are now kept on stack instead. A pixel is
+* pushed once, when it becomes an EDGE, so stack needs room for the possible
+* edges of the image, see follow_stack(). The edges found do not depend on
+* the order they are visited in.
 * NAME: Mike Heath
 * DATE: 2/15/96
 *******************************************************************************/
-void follow_edges(unsigned char *edgemapptr, short *edgemagptr, short lowval, int cols)
+void follow_edges(unsigned char *edge, const short *mag, int pos, short lowval, int cols,
+                  int *stack)
 {
-    short *tempmagptr;
-    unsigned char *tempmapptr;
-    int i;
-    int x[8] = {1,1,0,-1,-1,-1,0,1},
-               y[8] = {0,1,1,1,0,-1,-1,-1};
+    int i, n, next;
+    int offset[8] = { 1, 1-cols, -cols, -1-cols, -1, cols-1, cols, cols+1 };
 
-    for(i=0; i<8; i++)
+    stack[0] = pos;
+    for(n=1; n>0; )
     {
-        tempmapptr = edgemapptr - y[i]*cols + x[i];
-        tempmagptr = edgemagptr - y[i]*cols + x[i];
-
-        if((*tempmapptr == POSSIBLE_EDGE) && (*tempmagptr > lowval))
+        pos = stack[--n];
+        for(i=0; i<8; i++)
         {
-            *tempmapptr = (unsigned char) EDGE;
-            follow_edges(tempmapptr,tempmagptr, lowval, cols);
+            next = pos + offset[i];
+            if((edge[next] == POSSIBLE_EDGE) && (mag[next] > lowval))
+            {
+                edge[next] = (unsigned char) EDGE;
+                stack[n++] = next;
+            }
         }
     }
 }
 
 /*******************************************************************************
-* PROCEDURE: apply_hysteresis
-* PURPOSE: This routine finds edges that are above some high threshhold or
-* are connected to a high pixel by a path of pixels greater than a low
-* threshold.
-* NAME: Mike Heath
-* DATE: 2/15/96
+* PROCEDURE: follow_edges_squared
+* PURPOSE: follow_edges for the squared magnitudes of MAGNITUDE_SQUARED, lowval
+* is a squared threshold as well.
 *******************************************************************************/
-void apply_hysteresis(short int *mag, unsigned char *nms, int rows, int cols,
-                      float tlow, float thigh, unsigned char *edge)
+void follow_edges_squared(unsigned char *edge, const int *magsq, int pos, int lowval, int cols,
+                          int *stack)
 {
-    int r, c, pos, numedges, highcount, lowthreshold, highthreshold, hist[32768];
-    short int maximum_mag=0;
+    int i, n, next;
+    int offset[8] = { 1, 1-cols, -cols, -1-cols, -1, cols-1, cols, cols+1 };
 
-    /****************************************************************************
-    * Initialize the edge map to possible edges everywhere the non-maximal
-    * suppression suggested there could be an edge except for the border. At
-    * the border we say there can not be an edge because it makes the
-    * follow_edges algorithm more efficient to not worry about tracking an
-    * edge off the side of the image.
-    ****************************************************************************/
-    for(r=0,pos=0; r<rows; r++)
+    stack[0] = pos;
+    for(n=1; n>0; )
     {
-        for(c=0; c<cols; c++,pos++)
+        pos = stack[--n];
+        for(i=0; i<8; i++)
         {
-            if(nms[pos] == POSSIBLE_EDGE) edge[pos] = POSSIBLE_EDGE;
-            else edge[pos] = NOEDGE;
+            next = pos + offset[i];
+            if((edge[next] == POSSIBLE_EDGE) && (magsq[next] > lowval))
+            {
+                edge[next] = (unsigned char) EDGE;
+                stack[n++] = next;
+            }
         }
     }
+}
+
+/*******************************************************************************
+* PROCEDURE: follow_stack
+* PURPOSE: Allocate the stack follow_edges needs for the candidates of cand.
+*******************************************************************************/
+static int *follow_stack(const nms_candidates *cand)
+{
+    int *stack;
+
+    if((stack = (int *) malloc((cand->count + 1)*sizeof(int))) == NULL)
+    {
+        fprintf(stderr, "Error allocating the edge following stack.\n");
+        exit(1);
+    }
+    return stack;
+}
+
+/*******************************************************************************
+* PROCEDURE: nms_candidates_init
+* PURPOSE: Start an empty candidate list.
+*******************************************************************************/
+void nms_candidates_init(nms_candidates *cand)
+{
+    cand->count = cand->size = cand->fitted = 0;
+    cand->pos = cand->mag = NULL;
+    cand->subpixel = 0;
+    cand->offset = NULL;
+    cand->direction = NULL;
+    cand->hist = NULL;
+    cand->bins = cand->hist_shift = cand->maximum = 0;
+}
+
+/*******************************************************************************
+* PROCEDURE: nms_candidates_reserve
+* PURPOSE: Make room for n more candidates. The list grows by doubling, so a
+* caller reserves a row at a time and then stores into pos and mag directly.
+*******************************************************************************/
+void nms_candidates_reserve(nms_candidates *cand, int n)
+{
+    if(cand->count + n <= cand->size) return;
+
+    cand->size = (2*cand->size > cand->count + n) ? 2*cand->size : cand->count + n;
+    if(((cand->pos = (int *) realloc(cand->pos, cand->size*sizeof(int))) == NULL) ||
+       ((cand->mag = (int *) realloc(cand->mag, cand->size*sizeof(int))) == NULL) ||
+       (cand->subpixel &&
+        (((cand->offset = (short *) realloc(cand->offset, cand->size*sizeof(short))) == NULL) ||
+         ((cand->direction = (unsigned short *) realloc(cand->direction,
+                                 cand->size*sizeof(unsigned short))) == NULL))))
+    {
+        fprintf(stderr, "Error allocating the candidate list.\n");
+        exit(1);
+    }
+}
+
+/*******************************************************************************
+* PROCEDURE: nms_candidates_grow_hist
+* PURPOSE: Make the histogram big enough for bin, at least doubling it.
+*******************************************************************************/
+void nms_candidates_grow_hist(nms_candidates *cand, int bin)
+{
+    int bins = (2*cand->bins > bin) ? 2*cand->bins : bin + 1;
 
-    for(r=0,pos=0; r<rows; r++,pos+=cols)
+    if((cand->hist = (int *) realloc(cand->hist, bins*sizeof(int))) == NULL)
     {
-        edge[pos] = NOEDGE;
-        edge[pos+cols-1] = NOEDGE;
+        fprintf(stderr, "Error allocating the histogram.\n");
+        exit(1);
     }
-    pos = (rows-1) * cols;
-    for(c=0; c<cols; c++,pos++)
+    memset(&cand->hist[cand->bins], 0, (bins - cand->bins)*sizeof(int));
+    cand->bins = bins;
+}
+
+/*******************************************************************************
+* PROCEDURE: nms_candidates_free
+* PURPOSE: Free the list, it is empty again afterwards.
+*******************************************************************************/
+void nms_candidates_free(nms_candidates *cand)
+{
+    free(cand->pos);
+    free(cand->mag);
+    free(cand->offset);
+    free(cand->direction);
+    free(cand->hist);
+    nms_candidates_init(cand);
+}
+
+/*******************************************************************************
+* PROCEDURE: nms_collect_row
+* PURPOSE: Append the possible edges among the n pixels from pos of nms to
+* cand, with their magnitude from mag or, for MAGNITUDE_SQUARED, from magsq.
+* The other one is NULL.
+*******************************************************************************/
+void nms_collect_row(const unsigned char *nms, const short *mag, const int *magsq,
+                     int pos, int n, nms_candidates *cand)
+{
+    int end, m;
+
+    nms_candidates_reserve(cand, n);
+    cand->hist_shift = (mag != NULL) ? 0 : HIST_SQUARED_SHIFT;
+    for(end=pos+n; pos<end; pos++)
     {
-        edge[c] = NOEDGE;
-        edge[pos] = NOEDGE;
+        if(nms[pos] != POSSIBLE_EDGE) continue;
+        m = (mag != NULL) ? mag[pos] : magsq[pos];
+        cand->pos[cand->count] = pos;
+        cand->mag[cand->count++] = m;
+        nms_candidates_count(cand, m);
     }
+}
 
-    /****************************************************************************
-    * Compute the histogram of the magnitude image. Then use the histogram to
-    * compute hysteresis thresholds.
-    ****************************************************************************/
-    for(r=0; r<32768; r++) hist[r] = 0;
-    for(r=0,pos=0; r<rows; r++)
+/*******************************************************************************
+* PROCEDURE: candidate_value
+* PURPOSE: The magnitude at i of mag or, when it is NULL, the squared one of
+* magsq.
+*******************************************************************************/
+static inline long long candidate_value(const short *mag, const int *magsq, int i)
+{
+    return (mag != NULL) ? mag[i] : magsq[i];
+}
+
+/*******************************************************************************
+* PROCEDURE: nms_subpixel_row
+* PURPOSE: Fit the candidates collected since the last call, all on one row
+* whose derivatives are gradx and grady, when cand->subpixel is set. The
+* neighbours are interpolated as in non_max_supp_row_squared: scaled by the
+* larger gradient component a, side1 and side2 are the magnitudes one unit
+* step of that component against and along the gradient less m00. The
+* parabola through the three values peaks
+*     (side1 - side2) / (2*(side1 + side2))
+* steps along the gradient, the scale cancels, and a step is |g|/a pixels.
+* For MAGNITUDE_SQUARED the squares are fitted.
+*******************************************************************************/
+void nms_subpixel_row(const short *mag, const int *magsq, const short *gradx,
+                      const short *grady, int cols, nms_candidates *cand)
+{
+    int k, pos, c, d, a, b, first;
+    unsigned char dir;
+    long long side1, side2;
+    double delta, angle;
+
+    for(k=cand->fitted; cand->subpixel && k<cand->count; k++)
     {
-        for(c=0; c<cols; c++,pos++)
+        pos = cand->pos[k];
+        c = pos % cols;
+        dir = gradient_octant(gradx[c], grady[c]);
+        d = (dir & OCTANT_GX_POSITIVE) ? 1 : -1;
+        first = (dir & OCTANT_GY_POSITIVE) ? -cols : cols;  /* The row against the gradient. */
+        a = abs(gradx[c]);
+        b = abs(grady[c]);
+
+        if(dir & OCTANT_X_MAJOR)
+        {
+            side1 = (a-b)*candidate_value(mag, magsq, pos-d) +
+                    b*candidate_value(mag, magsq, pos+first-d);
+            side2 = (a-b)*candidate_value(mag, magsq, pos+d) +
+                    b*candidate_value(mag, magsq, pos-first+d);
+        }
+        else
         {
-            if(edge[pos] == POSSIBLE_EDGE)
-                hist[mag[pos]]++;
+            side1 = (b-a)*candidate_value(mag, magsq, pos+first) +
+                    a*candidate_value(mag, magsq, pos+first-d);
+            side2 = (b-a)*candidate_value(mag, magsq, pos-first) +
+                    a*candidate_value(mag, magsq, pos-first+d);
+            a = b;
         }
+        side1 -= a*candidate_value(mag, magsq, pos);
+        side2 -= a*candidate_value(mag, magsq, pos);
+
+        /* The float suppression of non_max_supp_row can keep a near tie the
+         * exact sides do not peak at, it stays on the pixel. */
+        delta = (side1 + side2 < 0) ? 0.5*(double)(side1 - side2)/(double)(side1 + side2) : 0.0;
+        if(delta > 0.5) delta = 0.5;
+        if(delta < -0.5) delta = -0.5;
+        if(a > 0) delta *= sqrt((double)gradx[c]*gradx[c] + (double)grady[c]*grady[c]) / a;
+        cand->offset[k] = (short) floor(0.5 + delta*SUBPIXEL_ONE);
+
+        angle = atan2(-(double)grady[c], (double)gradx[c]);
+        if(angle < 0) angle += 2*M_PI;
+        cand->direction[k] = (unsigned short)((int)(0.5 + angle*SUBPIXEL_TURN/(2*M_PI)) &
+                                              (SUBPIXEL_TURN-1));
     }
+    cand->fitted = cand->count;
+}
+
+/*******************************************************************************
+* PROCEDURE: collect_candidates
+* PURPOSE: Return cand or, when it is NULL, the possible edges of nms collected
+* into own, which the caller frees.
+*******************************************************************************/
+static const nms_candidates *collect_candidates(const unsigned char *nms, const short *mag,
+                                                const int *magsq, int rows, int cols,
+                                                const nms_candidates *cand,
+                                                nms_candidates *own)
+{
+    int r;
+
+    nms_candidates_init(own);
+    if(cand != NULL) return cand;
+    for(r=1; r<rows-1; r++)
+        nms_collect_row(nms, mag, magsq, r*cols+1, cols-2, own);
+    return own;
+}
+
+/*******************************************************************************
+* PROCEDURE: init_edge_map
+* PURPOSE: Initialize the edge map to possible edges everywhere the non-maximal
+* suppression suggested there could be an edge except for the border. At the
+* border we say there can not be an edge because it makes the follow_edges
+* algorithm more efficient to not worry about tracking an edge off the side
+* of the image. The possible edges are the ones in cand; when it is NULL they
+* are collected from nms into own, which the caller frees.
+* NAME: Mike Heath
+* DATE: 2/15/96
+*******************************************************************************/
+static const nms_candidates *init_edge_map(const unsigned char *nms, const short *mag,
+                                           const int *magsq, int rows, int cols,
+                                           unsigned char *edge, const nms_candidates *cand,
+                                           nms_candidates *own)
+{
+    int k;
+
+    cand = collect_candidates(nms, mag, magsq, rows, cols, cand, own);
+    memset(edge, NOEDGE, rows*cols);
+    for(k=0; k<cand->count; k++) edge[cand->pos[k]] = POSSIBLE_EDGE;
+
+    return cand;
+}
+
+/*******************************************************************************
+* PROCEDURE: hysteresis_thresholds
+* PURPOSE: Find the thresholds of apply_hysteresis for the candidates: an edge
+* starts at a magnitude of at least high and continues along magnitudes above
+* low.
+* NAME: Mike Heath
+* DATE: 2/15/96
+*******************************************************************************/
+static void hysteresis_thresholds(const nms_candidates *cand, float tlow, float thigh,
+                                  int *low, int *high)
+{
+    int r, numedges, highcount, lowthreshold, highthreshold;
+    const int *hist = cand->hist;
+    int maximum_mag = cand->maximum;
 
     /****************************************************************************
+    * The histogram of the non-zero magnitudes of the possible edges was counted
+    * as they were collected and only has bins up to about the largest one.
     * Compute the number of pixels that passed the nonmaximal suppression.
     ****************************************************************************/
-    for(r=1,numedges=0; r<32768; r++)
-    {
-        if(hist[r] != 0) maximum_mag = r;
-        numedges += hist[r];
-    }
+    for(r=1,numedges=0; r<cand->bins; r++) numedges += hist[r];
 
     highcount = (int)(numedges * thigh + 0.5);
 
@@ -119,7 +333,7 @@ void apply_hysteresis(short int *mag, unsigned char *nms, int rows, int cols,
     * choose tlow ~= 0.5 or 0.33333.
     ****************************************************************************/
     r = 1;
-    numedges = hist[1];
+    numedges = (maximum_mag >= 1) ? hist[1] : 0;
     while((r<(maximum_mag-1)) && (numedges < highcount))
     {
         r++;
@@ -135,240 +349,1218 @@ void apply_hysteresis(short int *mag, unsigned char *nms, int rows, int cols,
                lowthreshold, highthreshold);
     #endif
 
+    *low = lowthreshold;
+    *high = highthreshold;
+}
+
+/*******************************************************************************
+* PROCEDURE: apply_hysteresis
+* PURPOSE: This routine finds edges that are above some high threshhold or
+* are connected to a high pixel by a path of pixels greater than a low
+* threshold.
+* NAME: Mike Heath
+* DATE: 2/15/96
+*******************************************************************************/
+void apply_hysteresis(short int *mag, unsigned char *nms, int rows, int cols,
+                      float tlow, float thigh, unsigned char *edge,
+                      const nms_candidates *cand)
+{
+    int k, pos, lowthreshold, highthreshold;
+    int *stack;                /* For follow_edges. */
+    nms_candidates own;
+
+    cand = init_edge_map(nms, mag, NULL, rows, cols, edge, cand, &own);
+    hysteresis_thresholds(cand, tlow, thigh, &lowthreshold, &highthreshold);
+
     /****************************************************************************
     * This loop looks for pixels above the highthreshold to locate edges and
     * then calls follow_edges to continue the edge.
     ****************************************************************************/
-    for(r=0,pos=0; r<rows; r++)
+    stack = follow_stack(cand);
+    for(k=0; k<cand->count; k++)
     {
-        for(c=0; c<cols; c++,pos++)
+        pos = cand->pos[k];
+        if((edge[pos] == POSSIBLE_EDGE) && (cand->mag[k] >= highthreshold))
         {
-            if((edge[pos] == POSSIBLE_EDGE) && (mag[pos] >= highthreshold))
-            {
-                edge[pos] = EDGE;
-                follow_edges((edge+pos), (mag+pos), lowthreshold, cols);
-            }
+            edge[pos] = EDGE;
+            follow_edges(edge, mag, pos, lowthreshold, cols, stack);
         }
     }
+    free(stack);
 
     /****************************************************************************
     * Set all the remaining possible edges to non-edges.
     ****************************************************************************/
-    for(r=0,pos=0; r<rows; r++)
+    for(k=0; k<cand->count; k++)
+        if(edge[cand->pos[k]] != EDGE) edge[cand->pos[k]] = NOEDGE;
+
+    nms_candidates_free(&own);
+}
+
+/*******************************************************************************
+* PROCEDURE: rounded_root
+* PURPOSE: The magnitude magnitude_x_y gives for the squared magnitude n.
+*******************************************************************************/
+static int rounded_root(int n)
+{
+    return (int)(0.5 + sqrt((double)n));
+}
+
+/*******************************************************************************
+* PROCEDURE: squared_rank
+* PURPOSE: Return the k-th smallest (1 <= k <= their number) of the non-zero
+* squared magnitudes of the candidates. Their histogram, of the high 15 bits,
+* finds the range the value is in; a histogram of the low 16 bits of the
+* values in that range then finds the value itself.
+*******************************************************************************/
+static int squared_rank(const nms_candidates *cand, int k)
+{
+    int i, high, low, *hist;
+
+    for(high=0; k > cand->hist[high]; high++) k -= cand->hist[high];
+
+    if((hist = (int *) calloc(65536, sizeof(int))) == NULL)
     {
-        for(c=0; c<cols; c++,pos++) if(edge[pos] != EDGE) edge[pos] = NOEDGE;
+        fprintf(stderr, "Error allocating the histogram.\n");
+        exit(1);
     }
+    for(i=0; i<cand->count; i++)
+        if((cand->mag[i] > 0) && ((cand->mag[i] >> 16) == high))
+            hist[cand->mag[i] & 0xffff]++;
+    for(low=0; k > hist[low]; low++) k -= hist[low];
+    free(hist);
+
+    return (high << 16) | low;
 }
 
 /*******************************************************************************
-* PROCEDURE: non_max_supp
-* PURPOSE: This routine applies non-maximal suppression to the magnitude of
-* the gradient image.
-* NAME: Mike Heath
-* DATE: 2/15/96
+* PROCEDURE: hysteresis_thresholds_squared
+* PURPOSE: The thresholds of apply_hysteresis_squared. They are the ones
+* apply_hysteresis finds for the rounded square roots of the candidates. The
+* high one is the root of the value at the thigh percentage point, which
+* squared_rank finds without a full histogram of the magnitudes. Both are then
+* taken into the squared domain, where m >= h is n > h*h - h and m > l is
+* n > l*l + l, so an edge starts above highsq and continues above lowsq.
 *******************************************************************************/
-void non_max_supp(short *mag, short *gradx, short *grady, int nrows, int ncols, unsigned char *result)
+static void hysteresis_thresholds_squared(const nms_candidates *cand, float tlow, float thigh,
+                                          int *lowsq, int *highsq)
 {
-    int rowcount, colcount,count;
-    short *magrowptr,*magptr;
-    short *gxrowptr,*gxptr;
-    short *gyrowptr,*gyptr,z1,z2;
-    short m00,gx=0,gy=0;
-    float mag1,mag2,xperp=0.0,yperp=0.0;
-    unsigned char *resultrowptr, *resultptr;
+    int r, numedges, highcount, lowthreshold, highthreshold, maximum_mag;
+
+    /****************************************************************************
+    * Count the possible edges with a non-zero magnitude in the coarse
+    * histogram, of the high bits, the collection made.
+    ****************************************************************************/
+    for(r=0,numedges=0; r<cand->bins; r++) numedges += cand->hist[r];
+    maximum_mag = rounded_root(cand->maximum);
 
+    highcount = (int)(numedges * thigh + 0.5);
 
     /****************************************************************************
-    * Zero the edges of the result image.
+    * apply_hysteresis stops at the first magnitude where highcount edges are
+    * reached, but not before 1 or after maximum_mag-1.
     ****************************************************************************/
-    for(count=0,resultrowptr=result,resultptr=result+ncols*(nrows-1);
-            count<ncols; resultptr++,resultrowptr++,count++)
+    highthreshold = 1;
+    if(highcount > numedges) highthreshold = maximum_mag - 1;
+    else if(highcount > 0)
+        highthreshold = rounded_root(squared_rank(cand, highcount));
+    if(highthreshold > maximum_mag - 1) highthreshold = maximum_mag - 1;
+    if(highthreshold < 1) highthreshold = 1;
+    lowthreshold = (int)(highthreshold * tlow + 0.5);
+
+    *highsq = highthreshold * highthreshold - highthreshold;
+    if(lowthreshold < 0) *lowsq = -1;
+    else if(lowthreshold > 46340) *lowsq = 0x7fffffff;
+    else *lowsq = lowthreshold * lowthreshold + lowthreshold;
+
+    #ifdef VERBOSE
+        printf("The input low and high fractions of %f and %f computed to\n",
+               tlow, thigh);
+        printf("magnitude of the gradient threshold values of: %d %d\n",
+               lowthreshold, highthreshold);
+    #endif
+}
+
+/*******************************************************************************
+* PROCEDURE: apply_hysteresis_squared
+* PURPOSE: apply_hysteresis for the squared magnitudes of MAGNITUDE_SQUARED,
+* with the thresholds of hysteresis_thresholds_squared. For the same nms the
+* edges are exactly the ones apply_hysteresis marks.
+*******************************************************************************/
+void apply_hysteresis_squared(int *magsq, unsigned char *nms, int rows, int cols,
+                              float tlow, float thigh, unsigned char *edge,
+                              const nms_candidates *cand)
+{
+    int k, pos, highsq, lowsq, *stack;
+    nms_candidates own;
+
+    cand = init_edge_map(nms, NULL, magsq, rows, cols, edge, cand, &own);
+    hysteresis_thresholds_squared(cand, tlow, thigh, &lowsq, &highsq);
+
+    stack = follow_stack(cand);
+    for(k=0; k<cand->count; k++)
     {
-        *resultrowptr = *resultptr = (unsigned char) 0;
+        pos = cand->pos[k];
+        if((edge[pos] == POSSIBLE_EDGE) && (cand->mag[k] > highsq))
+        {
+            edge[pos] = EDGE;
+            follow_edges_squared(edge, magsq, pos, lowsq, cols, stack);
+        }
     }
+    free(stack);
 
-    for(count=0,resultptr=result,resultrowptr=result+ncols-1;
-            count<nrows; count++,resultptr+=ncols,resultrowptr+=ncols)
+    for(k=0; k<cand->count; k++)
+        if(edge[cand->pos[k]] != EDGE) edge[cand->pos[k]] = NOEDGE;
+
+    nms_candidates_free(&own);
+}
+
+/*******************************************************************************
+* PROCEDURE: node_thresholds
+* PURPOSE: The thresholds of apply_hysteresis, or for squared magnitudes of
+* apply_hysteresis_squared, as the magnitudes an edge starts above (seed) and
+* continues above (weak).
+*******************************************************************************/
+static void node_thresholds(const nms_candidates *cand, int exact, float tlow, float thigh,
+                            int *weak, int *seed)
+{
+    int low, high;
+
+    if(exact)
     {
-        *resultptr = *resultrowptr = (unsigned char) 0;
+        /* follow_edges compares with a short. */
+        hysteresis_thresholds(cand, tlow, thigh, &low, &high);
+        *weak = (short) low;
+        *seed = high - 1;
     }
+    else hysteresis_thresholds_squared(cand, tlow, thigh, weak, seed);
+}
 
-    /****************************************************************************
-    * Suppress non-maximum points.
-    ****************************************************************************/
-    for(rowcount=1,magrowptr=mag+ncols+1,gxrowptr=gradx+ncols+1,
-            gyrowptr=grady+ncols+1,resultrowptr=result+ncols+1;
-            rowcount<nrows-2;
-            rowcount++,magrowptr+=ncols,gyrowptr+=ncols,gxrowptr+=ncols,
-            resultrowptr+=ncols)
-    {
-        for(colcount=1,magptr=magrowptr,gxptr=gxrowptr,gyptr=gyrowptr,
-                resultptr=resultrowptr; colcount<ncols-2;
-                colcount++,magptr++,gxptr++,gyptr++,resultptr++)
+/* A band of rows apply_hysteresis_union labels in a thread of its own. */
+typedef struct
+{
+    const nms_candidates *cand;
+    unsigned char *edge;
+    int *label;                /* By candidate, see apply_hysteresis_union. */
+    int first, last;           /* Its candidates. */
+    int cols;
+    int seed, weak;            /* The magnitudes an edge starts and continues above. */
+    pthread_t thread;
+} hysteresis_strip;
+
+/* The labels of the roots in apply_hysteresis_union. */
+#define ROOT_WEAK -1
+#define ROOT_STRONG -2
+
+/*******************************************************************************
+* PROCEDURE: find_root
+* PURPOSE: Return the root of the component of p, pointing the pixels on the
+* way straight at it.
+*******************************************************************************/
+static int find_root(int *label, int p)
+{
+    int root, next;
+
+    for(root=p; label[root] >= 0; root=label[root]) ;
+    for(; p != root; p=next)
+    {
+        next = label[p];
+        label[p] = root;
+    }
+    return root;
+}
+
+/*******************************************************************************
+* PROCEDURE: join_roots
+* PURPOSE: Merge the components of p and q. The root is always the first
+* candidate of a component, so every other one points to one before it, and
+* it is strong when either one was.
+*******************************************************************************/
+static void join_roots(int *label, int p, int q)
+{
+    int t;
+
+    p = find_root(label, p);
+    q = find_root(label, q);
+    if(p == q) return;
+    if(p > q)
+    {
+        t = p;
+        p = q;
+        q = t;
+    }
+    if(label[q] < label[p]) label[p] = label[q];
+    label[q] = p;
+}
+
+/*******************************************************************************
+* PROCEDURE: link_root
+* PURPOSE: Join the component of candidate j to the one rooted at root, or to
+* none yet when root is negative, and return the root of the two.
+*******************************************************************************/
+static int link_root(int *label, int root, int j)
+{
+    j = find_root(label, j);
+    if((root < 0) || (root == j)) return j;
+    join_roots(label, root, j);
+    return (root < j) ? root : j;
+}
+
+/*******************************************************************************
+* PROCEDURE: join_north
+* PURPOSE: Join the nodes among the three pixels north of pixel p to the
+* component rooted at root (none when negative) and return its root. *up is
+* the first candidate that may be one of them; it only moves forward, as p
+* does, and never goes below the candidate it starts at.
+*******************************************************************************/
+static int join_north(const nms_candidates *cand, const unsigned char *edge, int *label,
+                      int root, int p, int cols, int *up)
+{
+    int j;
+
+    while(cand->pos[*up] < p-cols-1) (*up)++;
+    for(j=*up; cand->pos[j] <= p-cols+1; j++)
+        if(edge[cand->pos[j]] == POSSIBLE_EDGE) root = link_root(label, root, j);
+    return root;
+}
+
+/*******************************************************************************
+* PROCEDURE: label_strip
+* PURPOSE: Label the components within one strip. The candidates that can
+* neither start nor continue an edge become NOEDGE. The others join the
+* components of the nodes before them in raster order (west and the three to
+* the north) that are in the strip too, or start one of their own.
+*******************************************************************************/
+static void *label_strip(void *arg)
+{
+    hysteresis_strip *strip = (hysteresis_strip *) arg;
+    const nms_candidates *cand = strip->cand;
+    unsigned char *edge = strip->edge;
+    int *label = strip->label;
+    int k, p, m, root, up = strip->first;
+
+    for(k=strip->first; k<strip->last; k++)
+    {
+        p = cand->pos[k];
+        m = cand->mag[k];
+        if((m <= strip->weak) && (m <= strip->seed))
         {
-            m00 = *magptr;
-            if(m00 == 0)
-            {
-                *resultptr = (unsigned char) NOEDGE;
-            }
-            else
-            {
-                xperp = -(gx = *gxptr)/((float)m00);
-                yperp = (gy = *gyptr)/((float)m00);
-            }
+            edge[p] = NOEDGE;
+            continue;
+        }
 
-            if(gx >= 0)
-            {
-                if(gy >= 0)
-                {
-                    if (gx >= gy)
-                    {
-                        /* 111 */
-                        /* Left point */
-                        z1 = *(magptr - 1);
-                        z2 = *(magptr - ncols - 1);
-
-                        mag1 = (m00 - z1)*xperp + (z2 - z1)*yperp;
-
-                        /* Right point */
-                        z1 = *(magptr + 1);
-                        z2 = *(magptr + ncols + 1);
-
-                        mag2 = (m00 - z1)*xperp + (z2 - z1)*yperp;
-                    }
-                    else
-                    {
-                        /* 110 */
-                        /* Left point */
-                        z1 = *(magptr - ncols);
-                        z2 = *(magptr - ncols - 1);
-
-                        mag1 = (z1 - z2)*xperp + (z1 - m00)*yperp;
-
-                        /* Right point */
-                        z1 = *(magptr + ncols);
-                        z2 = *(magptr + ncols + 1);
-
-                        mag2 = (z1 - z2)*xperp + (z1 - m00)*yperp;
-                    }
-                }
-                else
-                {
-                    if (gx >= -gy)
-                    {
-                        /* 101 */
-                        /* Left point */
-                        z1 = *(magptr - 1);
-                        z2 = *(magptr + ncols - 1);
-
-                        mag1 = (m00 - z1)*xperp + (z1 - z2)*yperp;
-
-                        /* Right point */
-                        z1 = *(magptr + 1);
-                        z2 = *(magptr - ncols + 1);
-
-                        mag2 = (m00 - z1)*xperp + (z1 - z2)*yperp;
-                    }
-                    else
-                    {
-                        /* 100 */
-                        /* Left point */
-                        z1 = *(magptr + ncols);
-                        z2 = *(magptr + ncols - 1);
-
-                        mag1 = (z1 - z2)*xperp + (m00 - z1)*yperp;
-
-                        /* Right point */
-                        z1 = *(magptr - ncols);
-                        z2 = *(magptr - ncols + 1);
-
-                        mag2 = (z1 - z2)*xperp  + (m00 - z1)*yperp;
-                    }
-                }
-            }
-            else
-            {
-                if ((gy = *gyptr) >= 0)
-                {
-                    if (-gx >= gy)
-                    {
-                        /* 011 */
-                        /* Left point */
-                        z1 = *(magptr + 1);
-                        z2 = *(magptr - ncols + 1);
-
-                        mag1 = (z1 - m00)*xperp + (z2 - z1)*yperp;
-
-                        /* Right point */
-                        z1 = *(magptr - 1);
-                        z2 = *(magptr + ncols - 1);
-
-                        mag2 = (z1 - m00)*xperp + (z2 - z1)*yperp;
-                    }
-                    else
-                    {
-                        /* 010 */
-                        /* Left point */
-                        z1 = *(magptr - ncols);
-                        z2 = *(magptr - ncols + 1);
-
-                        mag1 = (z2 - z1)*xperp + (z1 - m00)*yperp;
-
-                        /* Right point */
-                        z1 = *(magptr + ncols);
-                        z2 = *(magptr + ncols - 1);
-
-                        mag2 = (z2 - z1)*xperp + (z1 - m00)*yperp;
-                    }
-                }
-                else
-                {
-                    if (-gx > -gy)
-                    {
-                        /* 001 */
-                        /* Left point */
-                        z1 = *(magptr + 1);
-                        z2 = *(magptr + ncols + 1);
-
-                        mag1 = (z1 - m00)*xperp + (z1 - z2)*yperp;
-
-                        /* Right point */
-                        z1 = *(magptr - 1);
-                        z2 = *(magptr - ncols - 1);
-
-                        mag2 = (z1 - m00)*xperp + (z1 - z2)*yperp;
-                    }
-                    else
-                    {
-                        /* 000 */
-                        /* Left point */
-                        z1 = *(magptr + ncols);
-                        z2 = *(magptr + ncols + 1);
-
-                        mag1 = (z2 - z1)*xperp + (m00 - z1)*yperp;
-
-                        /* Right point */
-                        z1 = *(magptr - ncols);
-                        z2 = *(magptr - ncols - 1);
-
-                        mag2 = (z2 - z1)*xperp + (m00 - z1)*yperp;
-                    }
-                }
-            }
+        root = -1;
+        if((k > strip->first) && (cand->pos[k-1] == p-1) && (edge[p-1] == POSSIBLE_EDGE))
+            root = find_root(label, k-1);
+        root = join_north(cand, edge, label, root, p, strip->cols, &up);
 
-            /* Now determine if the current point is a maximum point */
+        if(root < 0) label[k] = (m > strip->seed) ? ROOT_STRONG : ROOT_WEAK;
+        else
+        {
+            label[k] = root;
+            if(m > strip->seed) label[root] = ROOT_STRONG;
+        }
+    }
+    return NULL;
+}
 
-            if ((mag1 > 0.0) || (mag2 > 0.0))
-            {
-                *resultptr = (unsigned char) NOEDGE;
-            }
-            else
-            {
-                if (mag2 == 0.0)
-                    *resultptr = (unsigned char) NOEDGE;
-                else
-                    *resultptr = (unsigned char) POSSIBLE_EDGE;
-            }
+/*******************************************************************************
+* PROCEDURE: resolve_strip
+* PURPOSE: Turn the nodes of one strip into EDGE or NOEDGE by the root of
+* their component, once the strips have been joined. label is only read, so
+* the strips can do this at the same time.
+*******************************************************************************/
+static void *resolve_strip(void *arg)
+{
+    hysteresis_strip *strip = (hysteresis_strip *) arg;
+    const int *label = strip->label;
+    int k, p, root;
+
+    for(k=strip->first; k<strip->last; k++)
+    {
+        p = strip->cand->pos[k];
+        if(strip->edge[p] != POSSIBLE_EDGE) continue;
+        for(root=k; label[root] >= 0; root=label[root]) ;
+        strip->edge[p] = (label[root] == ROOT_STRONG) ? EDGE : NOEDGE;
+    }
+    return NULL;
+}
+
+/*******************************************************************************
+* PROCEDURE: run_strips
+* PURPOSE: Call fn for each of the n strips, in threads of their own but for
+* the last one, which the calling thread does, and wait for all of them.
+*******************************************************************************/
+static void run_strips(void *(*fn)(void *), hysteresis_strip *strip, int n)
+{
+    int i;
+
+    for(i=0; i<n-1; i++)
+    {
+        if(pthread_create(&strip[i].thread, NULL, fn, &strip[i]) != 0)
+        {
+            fprintf(stderr, "Error starting a hysteresis thread.\n");
+            exit(1);
+        }
+    }
+    fn(&strip[n-1]);
+    for(i=0; i<n-1; i++) pthread_join(strip[i].thread, NULL);
+}
+
+/*******************************************************************************
+* PROCEDURE: first_candidate
+* PURPOSE: Return the index of the first candidate at or after pixel pos.
+*******************************************************************************/
+static int first_candidate(const nms_candidates *cand, int pos)
+{
+    int lo = 0, hi = cand->count, mid;
+
+    while(lo < hi)
+    {
+        mid = (lo + hi) / 2;
+        if(cand->pos[mid] < pos) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/*******************************************************************************
+* PROCEDURE: apply_hysteresis_union
+* PURPOSE: apply_hysteresis, or apply_hysteresis_squared when mag is NULL,
+* with the connected components labelled in parallel instead of traced one
+* edge after the other. The candidates that start an edge or are above the
+* low threshold are the nodes of a graph with an arc between 8-neighbours.
+* A node is an edge exactly when its component has a node that starts one,
+* so the result is the same as the tracing gives.
+*
+* The image is cut into threads strips of rows (0 for one per CPU). Each
+* strip is labelled with union-find in its own thread, then the components
+* that meet across the seams between strips are joined, and finally the
+* strips mark their edges in parallel again. The labels are kept by
+* candidate, the candidates being in raster order, so they are dense and
+* the neighbours to the north are found by moving along the row above.
+*******************************************************************************/
+void apply_hysteresis_union(short int *mag, int *magsq, unsigned char *nms, int rows, int cols,
+                            float tlow, float thigh, unsigned char *edge,
+                            const nms_candidates *cand, int threads)
+{
+    int i, k, up, start, root, low, high, *label;
+    hysteresis_strip *strip;
+    nms_candidates own;
+
+    cand = init_edge_map(nms, mag, magsq, rows, cols, edge, cand, &own);
+
+    if(threads <= 0) threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if(threads > rows) threads = rows;
+    if(threads < 1) threads = 1;
+
+    if(((label = (int *) malloc((cand->count + 1)*sizeof(int))) == NULL) ||
+       ((strip = (hysteresis_strip *) malloc(threads*sizeof(hysteresis_strip))) == NULL))
+    {
+        fprintf(stderr, "Error allocating the component labels.\n");
+        exit(1);
+    }
+
+    for(i=0; i<threads; i++)
+    {
+        strip[i].cand = cand;
+        strip[i].edge = edge;
+        strip[i].label = label;
+        strip[i].cols = cols;
+        strip[i].first = first_candidate(cand, (int)((long long) rows*i/threads) * cols);
+        if(i > 0) strip[i-1].last = strip[i].first;
+    }
+    strip[threads-1].last = cand->count;
+
+    node_thresholds(cand, mag != NULL, tlow, thigh, &low, &high);
+    for(i=0; i<threads; i++)
+    {
+        strip[i].seed = high;
+        strip[i].weak = low;
+    }
+
+    run_strips(label_strip, strip, threads);
+
+    /****************************************************************************
+    * Join the components of the first row of each strip with the ones of the
+    * row above it, the last row of the strip before.
+    ****************************************************************************/
+    for(i=1; i<threads; i++)
+    {
+        start = (int)((long long) rows*i/threads) * cols;
+        up = first_candidate(cand, start - cols);
+        for(k=strip[i].first; (k<cand->count) && (cand->pos[k]<start+cols); k++)
+        {
+            if(edge[cand->pos[k]] != POSSIBLE_EDGE) continue;
+            root = join_north(cand, edge, label, -1, cand->pos[k], cols, &up);
+            if(root >= 0) join_roots(label, k, root);
+        }
+    }
+
+    run_strips(resolve_strip, strip, threads);
+
+    free(strip);
+    free(label);
+    nms_candidates_free(&own);
+}
+
+/*******************************************************************************
+* PROCEDURE: fill_row
+* PURPOSE: Extend the bits of x, a subset of mask, over the runs of mask they
+* are in. Adding x to mask carries each bit up to the top of its run, which
+* the changed bits show; the carry goes on into the next word. Down to the
+* start of the run the bits are then spread 1, 2, 4 .. 32 places at a time
+* where mask is set all the way, from the last word to the first.
+*******************************************************************************/
+static void fill_row(bitword *x, const bitword *mask, int words)
+{
+    int w;
+    bitword sum, carry, run;
+
+    for(w=0,carry=0; w<words; w++)
+    {
+        sum = mask[w] + x[w];
+        run = (sum < mask[w]);
+        sum += carry;
+        carry = run | (sum < carry);
+        x[w] |= (sum ^ mask[w]) & mask[w];
+    }
+
+    for(w=words-1,carry=0; w>=0; w--)
+    {
+        x[w] |= (carry << (BITWORD_BITS-1)) & mask[w];
+        run = mask[w];
+        x[w] |= (x[w] >> 1) & run;
+        run &= run >> 1;
+        x[w] |= (x[w] >> 2) & run;
+        run &= run >> 2;
+        x[w] |= (x[w] >> 4) & run;
+        run &= run >> 4;
+        x[w] |= (x[w] >> 8) & run;
+        run &= run >> 8;
+        x[w] |= (x[w] >> 16) & run;
+        run &= run >> 16;
+        x[w] |= (x[w] >> 32) & run;
+        carry = x[w] & 1;
+    }
+}
+
+/*******************************************************************************
+* PROCEDURE: reconstruct_row
+* PURPOSE: Grow the edges of row r into its mask from the 3x3 neighbourhood of
+* the edges in the rows above and below, and then along the row. Returns 1
+* when the row changed. grow has room for one row.
+*******************************************************************************/
+static int reconstruct_row(bitword *mark, const bitword *mask, int r, int words, bitword *grow)
+{
+    const bitword *above = &mark[(r-1)*words], *below = &mark[(r+1)*words],
+                  *m = &mask[r*words];
+    bitword *row = &mark[r*words], v, prev, next, changed = 0;
+    int w;
+
+    for(w=0; w<words; w++) grow[w] = above[w] | below[w];
+    for(w=0,prev=0; w<words; w++)
+    {
+        v = grow[w];
+        next = (w < words-1) ? grow[w+1] : 0;
+        grow[w] = row[w] | ((v | (v << 1) | (v >> 1) | (prev >> (BITWORD_BITS-1)) |
+                             (next << (BITWORD_BITS-1))) & m[w]);
+        changed |= grow[w] ^ row[w];
+        prev = v;
+    }
+    if(changed == 0) return 0;
+
+    fill_row(grow, m, words);
+    memcpy(row, grow, words*sizeof(bitword));
+    return 1;
+}
+
+/*******************************************************************************
+* PROCEDURE: apply_hysteresis_reconstruct
+* PURPOSE: apply_hysteresis, or apply_hysteresis_squared when mag is NULL, as
+* a morphological reconstruction: the pixels that start an edge are dilated
+* by 3x3 within the mask of the candidates that start or continue one, until
+* nothing changes. The rows are packed to one bit per pixel and worked on a
+* word at a time, a row being filled along its runs of mask at once. Sweeps
+* down and up the image alternate, so an edge is followed as far as it goes
+* down (or up) in one sweep. Only rows next to a row that changed are looked
+* at again. The edges are the ones apply_hysteresis marks.
+*******************************************************************************/
+void apply_hysteresis_reconstruct(short int *mag, int *magsq, unsigned char *nms, int rows,
+                                  int cols, float tlow, float thigh, unsigned char *edge,
+                                  const nms_candidates *cand)
+{
+    int k, c, w, r, start, step, first, last, ndirty, weak, seed, words;
+    bitword *mask, *mark, *grow, bit, maskbits, markbits;
+    unsigned char *dirty;      /* A row next to it changed since it was last grown. */
+    nms_candidates own;
+
+    cand = init_edge_map(nms, mag, magsq, rows, cols, edge, cand, &own);
+    node_thresholds(cand, mag != NULL, tlow, thigh, &weak, &seed);
+
+    words = (cols + BITWORD_BITS-1) / BITWORD_BITS;
+    if(((mask = (bitword *) calloc(rows*words, sizeof(bitword))) == NULL) ||
+       ((mark = (bitword *) calloc(rows*words, sizeof(bitword))) == NULL) ||
+       ((grow = (bitword *) malloc(words*sizeof(bitword))) == NULL) ||
+       ((dirty = (unsigned char *) calloc(rows, 1)) == NULL))
+    {
+        fprintf(stderr, "Error allocating the edge masks.\n");
+        exit(1);
+    }
+
+    /****************************************************************************
+    * Pack the candidates into the mask and the ones that start an edge into
+    * the marks, and fill those along their rows.
+    ****************************************************************************/
+    for(k=0,r=0,start=0,w=0,maskbits=markbits=0; k<cand->count; k++)
+    {
+        for(; cand->pos[k] >= start+cols; r++) start += cols;
+        c = r*words + (cand->pos[k] - start) / BITWORD_BITS;
+        if(c != w)
+        {
+            mask[w] |= maskbits;
+            mark[w] |= markbits;
+            maskbits = markbits = 0;
+            w = c;
+        }
+        bit = 1ULL << ((cand->pos[k] - start) % BITWORD_BITS);
+        maskbits |= bit & -(bitword)((cand->mag[k] > weak) | (cand->mag[k] > seed));
+        markbits |= bit & -(bitword)(cand->mag[k] > seed);
+    }
+    mask[w] |= maskbits;
+    mark[w] |= markbits;
+    for(r=1,ndirty=0; r<rows-1; r++)
+    {
+        for(k=0; (k<words) && (mark[r*words+k] == 0); k++) ;
+        if(k == words) continue;
+        fill_row(&mark[r*words], &mask[r*words], words);
+        ndirty += !dirty[r-1] + !dirty[r+1];
+        dirty[r-1] = dirty[r+1] = 1;
+    }
+
+    /****************************************************************************
+    * Sweep down and up over the rows to grow until none is left. The first
+    * and the last row are never candidates and stay empty.
+    ****************************************************************************/
+    for(step=1; ndirty>0; step=-step)
+    {
+        first = (step > 0) ? 1 : rows-2;
+        last = (step > 0) ? rows-1 : 0;
+        for(r=first; r!=last; r+=step)
+        {
+            if(!dirty[r]) continue;
+            dirty[r] = 0;
+            ndirty--;
+            if(!reconstruct_row(mark, mask, r, words, grow)) continue;
+            ndirty += !dirty[r-1] + !dirty[r+1];
+            dirty[r-1] = dirty[r+1] = 1;
+        }
+        ndirty -= dirty[0] + dirty[rows-1];
+        dirty[0] = dirty[rows-1] = 0;
+    }
+
+    for(k=0,r=0,start=0; k<cand->count; k++)
+    {
+        for(; cand->pos[k] >= start+cols; r++) start += cols;
+        c = r*words + (cand->pos[k] - start) / BITWORD_BITS;
+        bit = 1ULL << ((cand->pos[k] - start) % BITWORD_BITS);
+        edge[cand->pos[k]] = (mark[c] & bit) ? EDGE : NOEDGE;
+    }
+
+    free(dirty);
+    free(grow);
+    free(mark);
+    free(mask);
+    nms_candidates_free(&own);
+}
+
+/*******************************************************************************
+* PROCEDURE: edge_mask_init
+* PURPOSE: Allocate mask for an image of rows by cols with no edges.
+*******************************************************************************/
+void edge_mask_init(edge_mask *mask, int rows, int cols)
+{
+    mask->rows = rows;
+    mask->cols = cols;
+    mask->words = (cols + BITWORD_BITS-1) / BITWORD_BITS;
+    if((mask->bits = (bitword *) calloc(rows*mask->words, sizeof(bitword))) == NULL)
+    {
+        fprintf(stderr, "Error allocating the edge mask.\n");
+        exit(1);
+    }
+}
+
+/*******************************************************************************
+* PROCEDURE: edge_mask_free
+*******************************************************************************/
+void edge_mask_free(edge_mask *mask)
+{
+    free(mask->bits);
+    mask->bits = NULL;
+}
+
+/*******************************************************************************
+* PROCEDURE: edge_mask_clear_border
+* PURPOSE: Clear the first and the last row and column of mask, where
+* init_edge_map says there can not be an edge, and the bits past cols, a word
+* at a time.
+*******************************************************************************/
+void edge_mask_clear_border(edge_mask *mask)
+{
+    int r, words = mask->words, last = (mask->cols - 1) % BITWORD_BITS;
+    bitword tail = (~0ULL >> (BITWORD_BITS-1 - last)) & ~(1ULL << last);
+
+    if((mask->rows == 0) || (words == 0)) return;
+    memset(mask->bits, 0, words*sizeof(bitword));
+    memset(&mask->bits[(mask->rows-1)*words], 0, words*sizeof(bitword));
+    for(r=1; r<mask->rows-1; r++)
+    {
+        mask->bits[r*words] &= ~1ULL;
+        mask->bits[r*words + words-1] &= tail;
+    }
+}
+
+/*******************************************************************************
+* PROCEDURE: edge_mask_bytes
+* PURPOSE: Write mask out as an edge image, EDGE for its bits and NOEDGE for
+* the rest.
+*******************************************************************************/
+void edge_mask_bytes(const edge_mask *mask, unsigned char *edge)
+{
+    int r, w;
+    const bitword *row;
+    bitword bits;
+
+    for(r=0; r<mask->rows; r++, edge+=mask->cols)
+    {
+        row = &mask->bits[r*mask->words];
+        memset(edge, NOEDGE, mask->cols);
+        for(w=0; w<mask->words; w++)
+            for(bits=row[w]; bits!=0; bits&=bits-1)
+                edge[w*BITWORD_BITS + __builtin_ctzll(bits)] = EDGE;
+    }
+}
+
+/*******************************************************************************
+* PROCEDURE: edge_mask_pack
+* PURPOSE: Set the bits of mask, allocated with edge_mask_init, to the EDGE
+* pixels of the edge image.
+*******************************************************************************/
+void edge_mask_pack(edge_mask *mask, const unsigned char *edge)
+{
+    int r, c;
+    bitword *row;
+
+    memset(mask->bits, 0, mask->rows*mask->words*sizeof(bitword));
+    for(r=0; r<mask->rows; r++, edge+=mask->cols)
+    {
+        row = &mask->bits[r*mask->words];
+        for(c=0; c<mask->cols; c++)
+            row[c / BITWORD_BITS] |= (bitword)(edge[c] == EDGE) << (c % BITWORD_BITS);
+    }
+}
+
+/* The states of apply_hysteresis_packed, two bits a pixel. */
+#define STATE_WEAK 1ULL        /* A candidate an edge can continue along. */
+#define STATE_EDGE 2ULL
+#define STATE_PIXELS (BITWORD_BITS/2)
+
+/*******************************************************************************
+* PROCEDURE: mark_edge
+* PURPOSE: Make pixel q of the state plane an edge if it is weak. Returns
+* whether it was.
+*******************************************************************************/
+static inline int mark_edge(bitword *state, unsigned int q)
+{
+    bitword *cell = &state[q / STATE_PIXELS];
+    unsigned int shift = 2*(q % STATE_PIXELS);
+
+    if(((*cell >> shift) & 3) != STATE_WEAK) return 0;
+    *cell ^= (STATE_WEAK | STATE_EDGE) << shift;
+    return 1;
+}
+
+/*******************************************************************************
+* PROCEDURE: follow_packed
+* PURPOSE: follow_edges on the state plane of apply_hysteresis_packed, whose
+* rows are stride pixels apart. The weak pixels already passed the low
+* threshold, so no magnitudes are read.
+*******************************************************************************/
+static void follow_packed(bitword *state, int q, int stride, int *stack)
+{
+    int i, n, next;
+    int offset[8] = { 1, 1-stride, -stride, -1-stride, -1, stride-1, stride, stride+1 };
+
+    stack[0] = q;
+    for(n=1; n>0; )
+    {
+        q = stack[--n];
+        for(i=0; i<8; i++)
+        {
+            next = q + offset[i];
+            if(mark_edge(state, next)) stack[n++] = next;
+        }
+    }
+}
+
+/*******************************************************************************
+* PROCEDURE: edge_bits
+* PURPOSE: The STATE_EDGE bits of the STATE_PIXELS states in x, packed into
+* the low half of a word.
+*******************************************************************************/
+static bitword edge_bits(bitword x)
+{
+    x = (x >> 1) & 0x5555555555555555ULL;
+    x = (x | (x >> 1)) & 0x3333333333333333ULL;
+    x = (x | (x >> 2)) & 0x0f0f0f0f0f0f0f0fULL;
+    x = (x | (x >> 4)) & 0x00ff00ff00ff00ffULL;
+    x = (x | (x >> 8)) & 0x0000ffff0000ffffULL;
+    return (x | (x >> 16)) & 0x00000000ffffffffULL;
+}
+
+/*******************************************************************************
+* PROCEDURE: apply_hysteresis_packed
+* PURPOSE: apply_hysteresis, or apply_hysteresis_squared when mag is NULL, on
+* a plane of two bits a pixel instead of the edge image and the magnitudes.
+* The candidates an edge can start or continue at are made weak in it; the
+* edges are traced from the ones above the high threshold as in
+* apply_hysteresis, turning weak pixels into edges. The plane has two words
+* for each word of mask, so the edge bits are taken into mask a word at a
+* time, which leaves the pixels that were not reached clear. No edge image is
+* made; see edge_mask_bytes. The edges are the ones apply_hysteresis marks.
+*******************************************************************************/
+void apply_hysteresis_packed(short int *mag, int *magsq, unsigned char *nms, int rows,
+                             int cols, float tlow, float thigh, edge_mask *mask,
+                             const nms_candidates *cand)
+{
+    int k, w, r, q, start, stride, weak, seed;
+    int *stack;                /* For follow_packed. */
+    bitword *state;
+    nms_candidates own;
+
+    cand = collect_candidates(nms, mag, magsq, rows, cols, cand, &own);
+    node_thresholds(cand, mag != NULL, tlow, thigh, &weak, &seed);
+
+    edge_mask_init(mask, rows, cols);
+    stride = mask->words * BITWORD_BITS;
+    if((state = (bitword *) calloc(2*rows*mask->words, sizeof(bitword))) == NULL)
+    {
+        fprintf(stderr, "Error allocating the state plane.\n");
+        exit(1);
+    }
+
+    for(k=0,r=0,start=0; k<cand->count; k++)
+    {
+        for(; cand->pos[k] >= start+cols; r++) start += cols;
+        if((cand->mag[k] > weak) || (cand->mag[k] > seed))
+        {
+            q = r*stride + cand->pos[k] - start;
+            state[q / STATE_PIXELS] |= STATE_WEAK << 2*(q % STATE_PIXELS);
+        }
+    }
+
+    stack = follow_stack(cand);
+    for(k=0,r=0,start=0; k<cand->count; k++)
+    {
+        for(; cand->pos[k] >= start+cols; r++) start += cols;
+        if(cand->mag[k] <= seed) continue;
+        q = r*stride + cand->pos[k] - start;
+        if(mark_edge(state, q)) follow_packed(state, q, stride, stack);
+    }
+    free(stack);
+
+    for(w=0; w<rows*mask->words; w++)
+        mask->bits[w] = edge_bits(state[2*w]) | (edge_bits(state[2*w+1]) << STATE_PIXELS);
+    edge_mask_clear_border(mask);
+
+    free(state);
+    nms_candidates_free(&own);
+}
+
+/*******************************************************************************
+* PROCEDURE: non_max_supp_row
+* PURPOSE: Apply non-maximal suppression to the columns 1..ncols-3 of one row.
+* above, mag and below are the magnitude rows around it, gradx and grady its
+* gradients and dir their gradient_octant codes, which pick the neighbours to
+* interpolate. A pixel with a zero magnitude is tested with the gradient of the
+* pixel before it; state carries that gradient from one call to the next, so
+* calling this for every row gives exactly what non_max_supp gives.
+* NAME: Mike Heath
+* DATE: 2/15/96
+*******************************************************************************/
+void non_max_supp_row(const short *above, const short *mag, const short *below,
+                      const short *gradx, const short *grady, const unsigned char *dir,
+                      int ncols, unsigned char *result, nms_state *state)
+{
+    int c;
+    short z1,z2;
+    short m00,gx=state->gx,gy=state->gy;
+    unsigned char code = gradient_octant(gx, gy);
+    float mag1,mag2,xperp=state->xperp,yperp=state->yperp;
+
+    for(c=1; c<ncols-2; c++)
+    {
+        m00 = mag[c];
+        if(m00 == 0)
+        {
+            result[c] = (unsigned char) NOEDGE;
+
+            /* The stale gradient keeps its octant, except that the tests
+             * the codes replace read gy afresh when gx < 0, and kept it. */
+            if(gx < 0) code = gradient_octant(gx, gy = grady[c]);
+        }
+        else
+        {
+            xperp = -(gx = gradx[c])/((float)m00);
+            yperp = (gy = grady[c])/((float)m00);
+            code = dir[c];
+        }
+
+        if(code & OCTANT_GX_POSITIVE)
+        {
+            if(code & OCTANT_GY_POSITIVE)
+            {
+                if(code & OCTANT_X_MAJOR)
+                {
+                    /* 111 */
+                    /* Left point */
+                    z1 = mag[c-1];
+                    z2 = above[c-1];
+
+                    mag1 = (m00 - z1)*xperp + (z2 - z1)*yperp;
+
+                    /* Right point */
+                    z1 = mag[c+1];
+                    z2 = below[c+1];
+
+                    mag2 = (m00 - z1)*xperp + (z2 - z1)*yperp;
+                }
+                else
+                {
+                    /* 110 */
+                    /* Left point */
+                    z1 = above[c];
+                    z2 = above[c-1];
+
+                    mag1 = (z1 - z2)*xperp + (z1 - m00)*yperp;
+
+                    /* Right point */
+                    z1 = below[c];
+                    z2 = below[c+1];
+
+                    mag2 = (z1 - z2)*xperp + (z1 - m00)*yperp;
+                }
+            }
+            else
+            {
+                if(code & OCTANT_X_MAJOR)
+                {
+                    /* 101 */
+                    /* Left point */
+                    z1 = mag[c-1];
+                    z2 = below[c-1];
+
+                    mag1 = (m00 - z1)*xperp + (z1 - z2)*yperp;
+
+                    /* Right point */
+                    z1 = mag[c+1];
+                    z2 = above[c+1];
+
+                    mag2 = (m00 - z1)*xperp + (z1 - z2)*yperp;
+                }
+                else
+                {
+                    /* 100 */
+                    /* Left point */
+                    z1 = below[c];
+                    z2 = below[c-1];
+
+                    mag1 = (z1 - z2)*xperp + (m00 - z1)*yperp;
+
+                    /* Right point */
+                    z1 = above[c];
+                    z2 = above[c+1];
+
+                    mag2 = (z1 - z2)*xperp  + (m00 - z1)*yperp;
+                }
+            }
+        }
+        else
+        {
+            if(code & OCTANT_GY_POSITIVE)
+            {
+                if(code & OCTANT_X_MAJOR)
+                {
+                    /* 011 */
+                    /* Left point */
+                    z1 = mag[c+1];
+                    z2 = above[c+1];
+
+                    mag1 = (z1 - m00)*xperp + (z2 - z1)*yperp;
+
+                    /* Right point */
+                    z1 = mag[c-1];
+                    z2 = below[c-1];
+
+                    mag2 = (z1 - m00)*xperp + (z2 - z1)*yperp;
+                }
+                else
+                {
+                    /* 010 */
+                    /* Left point */
+                    z1 = above[c];
+                    z2 = above[c+1];
+
+                    mag1 = (z2 - z1)*xperp + (z1 - m00)*yperp;
+
+                    /* Right point */
+                    z1 = below[c];
+                    z2 = below[c-1];
+
+                    mag2 = (z2 - z1)*xperp + (z1 - m00)*yperp;
+                }
+            }
+            else
+            {
+                if(code & OCTANT_X_MAJOR)
+                {
+                    /* 001 */
+                    /* Left point */
+                    z1 = mag[c+1];
+                    z2 = below[c+1];
+
+                    mag1 = (z1 - m00)*xperp + (z1 - z2)*yperp;
+
+                    /* Right point */
+                    z1 = mag[c-1];
+                    z2 = above[c-1];
+
+                    mag2 = (z1 - m00)*xperp + (z1 - z2)*yperp;
+                }
+                else
+                {
+                    /* 000 */
+                    /* Left point */
+                    z1 = below[c];
+                    z2 = below[c+1];
+
+                    mag1 = (z2 - z1)*xperp + (m00 - z1)*yperp;
+
+                    /* Right point */
+                    z1 = above[c];
+                    z2 = above[c-1];
+
+                    mag2 = (z2 - z1)*xperp + (m00 - z1)*yperp;
+                }
+            }
+        }
+
+        /* Now determine if the current point is a maximum point */
+
+        if ((mag1 > 0.0) || (mag2 > 0.0))
+        {
+            result[c] = (unsigned char) NOEDGE;
+        }
+        else
+        {
+            if (mag2 == 0.0)
+                result[c] = (unsigned char) NOEDGE;
+            else
+                result[c] = (unsigned char) POSSIBLE_EDGE;
+        }
+    }
+
+    state->gx = gx;
+    state->gy = gy;
+    state->xperp = xperp;
+    state->yperp = yperp;
+}
+
+/*******************************************************************************
+* PROCEDURE: nms_advance
+* PURPOSE: Leave state as non_max_supp_row would after the n pixels from
+* mag, gradx and grady, for a caller that has suppressed them some other way:
+* the gradient of the last pixel with a magnitude, with its gy refreshed from
+* the last pixel when gx < 0 and the pixels after it have none.
+*******************************************************************************/
+void nms_advance(const short *mag, const short *gradx, const short *grady, int n,
+                 nms_state *state)
+{
+    int c = n - 1;
+    short m00;
+
+    while(c >= 0 && mag[c] == 0) c--;
+    if(c >= 0)
+    {
+        m00 = mag[c];
+        state->xperp = -(state->gx = gradx[c])/((float)m00);
+        state->yperp = (state->gy = grady[c])/((float)m00);
+    }
+    if(c < n-1 && state->gx < 0) state->gy = grady[n-1];
+}
+
+/*******************************************************************************
+* PROCEDURE: non_max_supp_row_squared
+* PURPOSE: non_max_supp_row for the squared magnitudes of MAGNITUDE_SQUARED.
+* Each of the eight cases of non_max_supp_row compares m00 with the value
+* interpolated between an axis neighbour z1 and a diagonal neighbour z2, on
+* both sides of the pixel along the gradient. Scaled by the larger (a) of
+* |gx| and |gy|, with b the smaller one, the difference is
+*     (a-b)*z1 + b*z2 - a*m00
+* which is computed exactly here, with the neighbours picked by the
+* gradient_octant codes in dir. The squares are interpolated instead of the
+* magnitudes, which is not the same where the neighbours nearly tie, so the
+* result can differ from non_max_supp_row at a few pixels. A pixel with a
+* zero magnitude has a zero gradient and is never a possible edge.
+*******************************************************************************/
+void non_max_supp_row_squared(const int *above, const int *mag, const int *below,
+                              const short *gradx, const short *grady,
+                              const unsigned char *dir, int ncols, unsigned char *result)
+{
+    int c, d, a, b;
+    const int *first, *second;  /* The row against the gradient and the one along it. */
+    long long side1, side2;
+
+    for(c=1; c<ncols-2; c++)
+    {
+        d = (dir[c] & OCTANT_GX_POSITIVE) ? 1 : -1;
+        first = (dir[c] & OCTANT_GY_POSITIVE) ? above : below;
+        second = (dir[c] & OCTANT_GY_POSITIVE) ? below : above;
+        a = abs(gradx[c]);
+        b = abs(grady[c]);
+
+        if(dir[c] & OCTANT_X_MAJOR)
+        {
+            side1 = (long long)(a-b)*mag[c-d] + (long long)b*first[c-d];
+            side2 = (long long)(a-b)*mag[c+d] + (long long)b*second[c+d];
+        }
+        else
+        {
+            side1 = (long long)(b-a)*first[c] + (long long)a*first[c-d];
+            side2 = (long long)(b-a)*second[c] + (long long)a*second[c+d];
+            a = b;
+        }
+        side1 -= (long long)a*mag[c];
+        side2 -= (long long)a*mag[c];
+
+        if((side1 > 0) || (side2 >= 0)) result[c] = (unsigned char) NOEDGE;
+        else result[c] = (unsigned char) POSSIBLE_EDGE;
+    }
+}
+
+/*******************************************************************************
+* PROCEDURE: non_max_supp
+* PURPOSE: This routine applies non-maximal suppression to the magnitude of
+* the gradient image. Unless cand is NULL the possible edges are collected
+* into it as well.
+* NAME: Mike Heath
+* DATE: 2/15/96
+*******************************************************************************/
+void non_max_supp(short *mag, short *gradx, short *grady, int nrows, int ncols, unsigned char *result,
+                  nms_candidates *cand)
+{
+    int rowcount, count;
+    unsigned char *resultrowptr, *resultptr, *dir;
+    nms_state state = { 0, 0, 0.0, 0.0 };
+
+    if((dir = (unsigned char *) malloc(ncols)) == NULL)
+    {
+        fprintf(stderr, "Error allocating the direction row.\n");
+        exit(1);
+    }
+
+
+    /****************************************************************************
+    * Zero the edges of the result image.
+    ****************************************************************************/
+    for(count=0,resultrowptr=result,resultptr=result+ncols*(nrows-1);
+            count<ncols; resultptr++,resultrowptr++,count++)
+    {
+        *resultrowptr = *resultptr = (unsigned char) 0;
+    }
+
+    for(count=0,resultptr=result,resultrowptr=result+ncols-1;
+            count<nrows; count++,resultptr+=ncols,resultrowptr+=ncols)
+    {
+        *resultptr = *resultrowptr = (unsigned char) 0;
+    }
+
+    /****************************************************************************
+    * Suppress non-maximum points.
+    ****************************************************************************/
+    for(rowcount=1; rowcount<nrows-2; rowcount++)
+    {
+        for(count=0; count<ncols; count++)
+            dir[count] = gradient_octant(gradx[rowcount*ncols+count], grady[rowcount*ncols+count]);
+        non_max_supp_row(mag+(rowcount-1)*ncols, mag+rowcount*ncols, mag+(rowcount+1)*ncols,
+                         gradx+rowcount*ncols, grady+rowcount*ncols, dir, ncols,
+                         result+rowcount*ncols, &state);
+        if(cand != NULL)
+        {
+            nms_collect_row(result, mag, NULL, rowcount*ncols+1, ncols-3, cand);
+            nms_subpixel_row(mag, NULL, gradx+rowcount*ncols, grady+rowcount*ncols, ncols, cand);
+        }
+    }
+
+    free(dir);
+}
+
+/*******************************************************************************
+* PROCEDURE: non_max_supp_squared
+* PURPOSE: non_max_supp for the squared magnitudes of MAGNITUDE_SQUARED, with
+* non_max_supp_row_squared. The border is zeroed like clear_nms_border does,
+* the result is that of gradient_nms_squared on the same derivatives.
+*******************************************************************************/
+void non_max_supp_squared(int *magsq, short *gradx, short *grady, int nrows, int ncols,
+                          unsigned char *result, nms_candidates *cand)
+{
+    int r, c;
+    unsigned char *dir;
+
+    if((dir = (unsigned char *) malloc(ncols)) == NULL)
+    {
+        fprintf(stderr, "Error allocating the direction row.\n");
+        exit(1);
+    }
+
+    for(r=1; r<nrows-2; r++)
+    {
+        for(c=0; c<ncols; c++)
+            dir[c] = gradient_octant(gradx[r*ncols+c], grady[r*ncols+c]);
+        non_max_supp_row_squared(&magsq[(r-1)*ncols], &magsq[r*ncols], &magsq[(r+1)*ncols],
+                                 &gradx[r*ncols], &grady[r*ncols], dir, ncols,
+                                 &result[r*ncols]);
+        if(cand != NULL)
+        {
+            nms_collect_row(result, NULL, magsq, r*ncols+1, ncols-3, cand);
+            nms_subpixel_row(NULL, magsq, &gradx[r*ncols], &grady[r*ncols], ncols, cand);
+        }
+    }
+
+    clear_nms_border(result, nrows, ncols);
+
+    free(dir);
+}
+
+/*******************************************************************************
+* PROCEDURE: clear_nms_border
+* PURPOSE: Zero the edges of a result image of the fused gradient_nms stages.
+* Unlike non_max_supp, which leaves them alone, the row nrows-2 and the column
+* ncols-2 are zeroed along with the border.
+*******************************************************************************/
+void clear_nms_border(unsigned char *result, int nrows, int ncols)
+{
+    int r;
+
+    for(r=0; r<nrows; r++)
+    {
+        if(r == 0 || r >= nrows-2)
+        {
+            memset(&result[r*ncols], 0, ncols);
+            continue;
         }
+        result[r*ncols] = 0;
+        result[r*ncols+ncols-2] = 0;
+        result[r*ncols+ncols-1] = 0;
     }
 }
@@ -1,9 +1,151 @@
 #ifndef HYSTERESIS_H
 #define HYSTERESIS_H
 
-void follow_edges(unsigned char *edgemapptr, short *edgemagptr, short lowval, int cols);
+/* The labels of the nms and edge images. */
+#define NOEDGE 255
+#define POSSIBLE_EDGE 128
+#define EDGE 0
+
+/*******************************************************************************
+* The one byte direction codes of the gradient that the derivative stage
+* hands to the non-maximal suppression. OCTANT_GX_POSITIVE and
+* OCTANT_GY_POSITIVE are set for gx >= 0 and gy >= 0 and OCTANT_X_MAJOR when
+* gx is the larger component. A tie is x-major unless both are negative, as it
+* always was in Heath's non_max_supp. gradient_octant() is used per pixel, so
+* it is inline here.
+*******************************************************************************/
+#define OCTANT_GX_POSITIVE 4
+#define OCTANT_GY_POSITIVE 2
+#define OCTANT_X_MAJOR 1
+
+static inline unsigned char gradient_octant(short gx, short gy)
+{
+    int ax = (gx < 0) ? -gx : gx, ay = (gy < 0) ? -gy : gy;
+
+    return (unsigned char)(((gx >= 0) ? OCTANT_GX_POSITIVE : 0) |
+                           ((gy >= 0) ? OCTANT_GY_POSITIVE : 0) |
+                           (((ax > ay) || ((ax == ay) && ((gx >= 0) || (gy >= 0))))
+                            ? OCTANT_X_MAJOR : 0));
+}
+
+/* The gradient non_max_supp_row carries from one pixel to the next. */
+typedef struct
+{
+    short gx, gy;
+    float xperp, yperp;
+} nms_state;
+
+/*******************************************************************************
+* The possible edges of an nms image in raster order, with their magnitudes
+* (squared ones for MAGNITUDE_SQUARED). The suppression stages collect them
+* with nms_collect_row as the rows are finished, so the hysteresis only
+* visits these pixels instead of the whole image. Border pixels are never on
+* the list.
+*
+* With subpixel set (after nms_candidates_init, before the suppression) the
+* stages also fit each candidate with nms_subpixel_row while its row is in
+* hand: offset is where the magnitude peaks along the gradient, in
+* 1/SUBPIXEL_ONE pixels from the pixel centre, and direction the angle of the
+* gradient, SUBPIXEL_TURN per turn counterclockwise from the x axis with y up
+* (what radian_direction gives for xdirtag 1 and ydirtag -1).
+*
+* The histogram the hysteresis thresholds come from is counted as the
+* candidates are appended, with nms_candidates_count: hist[m >> hist_shift]
+* for each non-zero magnitude m, where hist_shift is 0 or, for squared
+* magnitudes, HIST_SQUARED_SHIFT. It has bins counts, only as many as the
+* largest magnitude so far, maximum, needs.
+*******************************************************************************/
+#define SUBPIXEL_ONE 4096
+#define SUBPIXEL_TURN 65536
+#define HIST_SQUARED_SHIFT 16
+
+typedef struct
+{
+    int count, size;
+    int *pos;
+    int *mag;
+    int subpixel;
+    int fitted;                /* The candidates nms_subpixel_row has done. */
+    short *offset;
+    unsigned short *direction;
+    int *hist;
+    int bins, hist_shift, maximum;
+} nms_candidates;
+
+void nms_candidates_init(nms_candidates *cand);
+void nms_candidates_reserve(nms_candidates *cand, int n);
+void nms_candidates_grow_hist(nms_candidates *cand, int bin);
+void nms_candidates_free(nms_candidates *cand);
+
+/* Count the magnitude m of an appended candidate into the histogram. */
+static inline void nms_candidates_count(nms_candidates *cand, int m)
+{
+    int bin = m >> cand->hist_shift;
+
+    if(m <= 0) return;
+    if(bin >= cand->bins) nms_candidates_grow_hist(cand, bin);
+    cand->hist[bin]++;
+    if(m > cand->maximum) cand->maximum = m;
+}
+
+/* A row of bits, bit c%BITWORD_BITS of word c/BITWORD_BITS for column c. */
+typedef unsigned long long bitword;
+#define BITWORD_BITS 64
+
+/*******************************************************************************
+* An edge image packed to one bit per pixel, set for the edges: rows of words
+* bitwords, the bits past cols clear. apply_hysteresis_packed marks the edges
+* in one; edge_mask_bytes turns it into the EDGE and NOEDGE bytes of an edge
+* image and edge_mask_pack packs one.
+*******************************************************************************/
+typedef struct
+{
+    int rows, cols, words;
+    bitword *bits;
+} edge_mask;
+
+void edge_mask_init(edge_mask *mask, int rows, int cols);
+void edge_mask_free(edge_mask *mask);
+void edge_mask_clear_border(edge_mask *mask);
+void edge_mask_bytes(const edge_mask *mask, unsigned char *edge);
+void edge_mask_pack(edge_mask *mask, const unsigned char *edge);
+
+void nms_collect_row(const unsigned char *nms, const short *mag, const int *magsq,
+                     int pos, int n, nms_candidates *cand);
+void nms_subpixel_row(const short *mag, const int *magsq, const short *gradx,
+                      const short *grady, int cols, nms_candidates *cand);
+
+void follow_edges(unsigned char *edge, const short *mag, int pos, short lowval, int cols,
+                  int *stack);
+void follow_edges_squared(unsigned char *edge, const int *magsq, int pos, int lowval, int cols,
+                          int *stack);
 void apply_hysteresis(short int *mag, unsigned char *nms, int rows, int cols,
-                      float tlow, float thigh, unsigned char *edge);
-void non_max_supp(short *mag, short *gradx, short *grady, int nrows, int ncols, unsigned char *result);
+                      float tlow, float thigh, unsigned char *edge,
+                      const nms_candidates *cand);
+void apply_hysteresis_squared(int *magsq, unsigned char *nms, int rows, int cols,
+                              float tlow, float thigh, unsigned char *edge,
+                              const nms_candidates *cand);
+void apply_hysteresis_union(short int *mag, int *magsq, unsigned char *nms, int rows, int cols,
+                            float tlow, float thigh, unsigned char *edge,
+                            const nms_candidates *cand, int threads);
+void apply_hysteresis_reconstruct(short int *mag, int *magsq, unsigned char *nms, int rows,
+                                  int cols, float tlow, float thigh, unsigned char *edge,
+                                  const nms_candidates *cand);
+void apply_hysteresis_packed(short int *mag, int *magsq, unsigned char *nms, int rows,
+                             int cols, float tlow, float thigh, edge_mask *mask,
+                             const nms_candidates *cand);
+void non_max_supp_row(const short *above, const short *mag, const short *below,
+                      const short *gradx, const short *grady, const unsigned char *dir,
+                      int ncols, unsigned char *result, nms_state *state);
+void nms_advance(const short *mag, const short *gradx, const short *grady, int n,
+                 nms_state *state);
+void non_max_supp_row_squared(const int *above, const int *mag, const int *below,
+                              const short *gradx, const short *grady,
+                              const unsigned char *dir, int ncols, unsigned char *result);
+void non_max_supp(short *mag, short *gradx, short *grady, int nrows, int ncols, unsigned char *result,
+                  nms_candidates *cand);
+void non_max_supp_squared(int *magsq, short *gradx, short *grady, int nrows, int ncols,
+                          unsigned char *result, nms_candidates *cand);
+void clear_nms_border(unsigned char *result, int nrows, int ncols);
 
 #endif /* HYSTERESIS_H */
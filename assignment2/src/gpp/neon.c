@@ -1,67 +1,308 @@
+/*******************************************************************************
+* FILE: neon.c
+* PURPOSE: Vectorised Canny kernels written against simd.h. This file is
+* compiled once per vector backend; SIMD_FN() gives every kernel the suffix
+* of the backend it was built for (gaussian_smooth_neon, _sse2, _avx2) and
+* dispatch.c picks the variant to use at run time.
+*******************************************************************************/
+
 #include "neon.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
-#include <arm_neon.h>
 #include <string.h>
+#include "canny_edge.h"
+#include "dispatch.h"
+#include "hysteresis.h"
+#include "simd.h"
 
 #define VERBOSE 0 
 
 /*******************************************************************************
-* PROCEDURE: make_gaussian_kernel
-* PURPOSE: Create a one dimensional gaussian kernel.
-* NAME: Mike Heath
-* DATE: 2/15/96
+* The inner loops of the float gaussian, blur_x_taps and blur_y_taps, are
+* generated once per odd window size from 3 to MAX_UNROLLED_TAPS with every
+* tap written out, and picked at run time from the windowsize of the kernel.
+* Larger windows use the _any versions that loop over the taps.
+*
+* blur_x_taps  out[c] = scale * sum(pad[c+k] * kernel[k]) for the first n
+*              pixels, n a multiple of 2*VF32_LANES.
+* blur_y_taps  out[c] = scale * sum(win[k][c] * kernel[k]) + 0.5 over the
+*              rows k0..k1-1, stored as shorts. The unrolled versions are
+*              only used for whole windows (k0 == 0, k1 == windowsize).
 *******************************************************************************/
-void make_gaussian_kernel(float sigma, float **kernel, int *windowsize)
+#define MAX_UNROLLED_TAPS 31
+
+typedef void (*blur_x_taps_fn)(const float *pad, float *out, int n, const float *kernel,
+                               int windowsize, vf32 scale);
+typedef void (*blur_y_taps_fn)(float **win, const float *kernel, int k0, int k1, int n,
+                               unsigned short int *out, vf32 scale);
+
+#define UNROLL_3(T)  T(0) T(1) T(2)
+#define UNROLL_5(T)  UNROLL_3(T)  T(3)  T(4)
+#define UNROLL_7(T)  UNROLL_5(T)  T(5)  T(6)
+#define UNROLL_9(T)  UNROLL_7(T)  T(7)  T(8)
+#define UNROLL_11(T) UNROLL_9(T)  T(9)  T(10)
+#define UNROLL_13(T) UNROLL_11(T) T(11) T(12)
+#define UNROLL_15(T) UNROLL_13(T) T(13) T(14)
+#define UNROLL_17(T) UNROLL_15(T) T(15) T(16)
+#define UNROLL_19(T) UNROLL_17(T) T(17) T(18)
+#define UNROLL_21(T) UNROLL_19(T) T(19) T(20)
+#define UNROLL_23(T) UNROLL_21(T) T(21) T(22)
+#define UNROLL_25(T) UNROLL_23(T) T(23) T(24)
+#define UNROLL_27(T) UNROLL_25(T) T(25) T(26)
+#define UNROLL_29(T) UNROLL_27(T) T(27) T(28)
+#define UNROLL_31(T) UNROLL_29(T) T(29) T(30)
+
+#define X_TAP(k) \
+    lo = vf32_mla(lo, vf32_load(&pad[c+(k)]), tap[k]); \
+    hi = vf32_mla(hi, vf32_load(&pad[c+(k)+VF32_LANES]), tap[k]);
+
+#define Y_TAP(k) \
+    lo = vf32_mla(lo, vf32_load(&win[k][c]), tap[k]); \
+    hi = vf32_mla(hi, vf32_load(&win[k][c+VF32_LANES]), tap[k]);
+
+/* The taps are broadcast once per call. out may alias kernel as far as the
+ * compiler knows, so it would otherwise reload them for every vector. */
+#define LOAD_TAP(k) tap[k] = vf32_dup(kernel[k]);
+
+#define X_STORE \
+    vf32_store(&out[c], vf32_mul(lo, scale)); \
+    vf32_store(&out[c+VF32_LANES], vf32_mul(hi, scale));
+
+#define Y_STORE \
+    lo = vf32_mla(vf32_dup(0.5f), lo, scale); \
+    hi = vf32_mla(vf32_dup(0.5f), hi, scale); \
+    vs16_store((short int *)&out[c], vs16_narrow(vf32_to_s32(lo), vf32_to_s32(hi)));
+
+#define BLUR_TAPS(W) \
+static void blur_x_taps_##W(const float *pad, float *out, int n, const float *kernel, \
+                            int windowsize, vf32 scale) \
+{ \
+    int c; \
+    vf32 lo, hi, tap[W]; \
+    UNROLL_##W(LOAD_TAP) \
+    for(c=0; c<n; c+=2*VF32_LANES) \
+    { \
+        lo = hi = vf32_dup(0.0f); \
+        UNROLL_##W(X_TAP) \
+        X_STORE \
+    } \
+} \
+static void blur_y_taps_##W(float **win, const float *kernel, int k0, int k1, int n, \
+                            unsigned short int *out, vf32 scale) \
+{ \
+    int c; \
+    vf32 lo, hi, tap[W]; \
+    UNROLL_##W(LOAD_TAP) \
+    for(c=0; c<n; c+=2*VF32_LANES) \
+    { \
+        lo = hi = vf32_dup(0.0f); \
+        UNROLL_##W(Y_TAP) \
+        Y_STORE \
+    } \
+}
+
+BLUR_TAPS(3)  BLUR_TAPS(5)  BLUR_TAPS(7)  BLUR_TAPS(9)
+BLUR_TAPS(11) BLUR_TAPS(13) BLUR_TAPS(15) BLUR_TAPS(17)
+BLUR_TAPS(19) BLUR_TAPS(21) BLUR_TAPS(23) BLUR_TAPS(25)
+BLUR_TAPS(27) BLUR_TAPS(29) BLUR_TAPS(31)
+
+static void blur_x_taps_any(const float *pad, float *out, int n, const float *kernel,
+                            int windowsize, vf32 scale)
 {
-    int i, center;
-    float x, fx, sum=0.0;
+    int c, k;
+    vf32 lo, hi, tap;
 
-    *windowsize = 1 + 2 * ceil(2.5 * sigma);
-    center = (*windowsize) / 2;
+    for(c=0; c<n; c+=2*VF32_LANES)
+    {
+        lo = hi = vf32_dup(0.0f);
+        for(k=0; k<windowsize; k++)
+        {
+            tap = vf32_dup(kernel[k]);
+            lo = vf32_mla(lo, vf32_load(&pad[c+k]), tap);
+            hi = vf32_mla(hi, vf32_load(&pad[c+k+VF32_LANES]), tap);
+        }
+        X_STORE
+    }
+}
 
-    if((*kernel = (float *) malloc((*windowsize)* sizeof(float))) == NULL)
+static void blur_y_taps_any(float **win, const float *kernel, int k0, int k1, int n,
+                            unsigned short int *out, vf32 scale)
+{
+    int c, k;
+    vf32 lo, hi, tap;
+
+    for(c=0; c<n; c+=2*VF32_LANES)
     {
-        fprintf(stderr, "Error callocing the gaussian kernel array.\n");
-        exit(1);
+        lo = hi = vf32_dup(0.0f);
+        for(k=k0; k<k1; k++)
+        {
+            tap = vf32_dup(kernel[k]);
+            lo = vf32_mla(lo, vf32_load(&win[k][c]), tap);
+            hi = vf32_mla(hi, vf32_load(&win[k][c+VF32_LANES]), tap);
+        }
+        Y_STORE
+    }
+}
+
+/* Indexed by the window size, even sizes never occur. */
+#define BLUR_TAPS_ENTRY(W) NULL, blur_x_taps_##W
+static const blur_x_taps_fn blur_x_taps[MAX_UNROLLED_TAPS+1] = {
+    NULL, NULL, NULL, blur_x_taps_3,
+    BLUR_TAPS_ENTRY(5),  BLUR_TAPS_ENTRY(7),  BLUR_TAPS_ENTRY(9),  BLUR_TAPS_ENTRY(11),
+    BLUR_TAPS_ENTRY(13), BLUR_TAPS_ENTRY(15), BLUR_TAPS_ENTRY(17), BLUR_TAPS_ENTRY(19),
+    BLUR_TAPS_ENTRY(21), BLUR_TAPS_ENTRY(23), BLUR_TAPS_ENTRY(25), BLUR_TAPS_ENTRY(27),
+    BLUR_TAPS_ENTRY(29), BLUR_TAPS_ENTRY(31)
+};
+#undef BLUR_TAPS_ENTRY
+#define BLUR_TAPS_ENTRY(W) NULL, blur_y_taps_##W
+static const blur_y_taps_fn blur_y_taps[MAX_UNROLLED_TAPS+1] = {
+    NULL, NULL, NULL, blur_y_taps_3,
+    BLUR_TAPS_ENTRY(5),  BLUR_TAPS_ENTRY(7),  BLUR_TAPS_ENTRY(9),  BLUR_TAPS_ENTRY(11),
+    BLUR_TAPS_ENTRY(13), BLUR_TAPS_ENTRY(15), BLUR_TAPS_ENTRY(17), BLUR_TAPS_ENTRY(19),
+    BLUR_TAPS_ENTRY(21), BLUR_TAPS_ENTRY(23), BLUR_TAPS_ENTRY(25), BLUR_TAPS_ENTRY(27),
+    BLUR_TAPS_ENTRY(29), BLUR_TAPS_ENTRY(31)
+};
+#undef BLUR_TAPS_ENTRY
+
+/*******************************************************************************
+* PROCEDURE: blur_x_row
+* PURPOSE: Blur one image row in the x-direction. The row is widened into the
+* float buffer pad (cols+windowsize floats) with center pixels on both sides
+* that hold what options.border reads past the row, zeros for a dropped tap.
+* blur_x_taps then broadcasts each tap and multiplies it into 2*VF32_LANES
+* consecutive output pixels at once, so no horizontal sums are needed and the
+* whole row is done without border tests. With BORDER_RENORMALISE the center
+* pixels at each border are rescaled afterwards from the rescale table.
+*******************************************************************************/
+static void blur_x_row(const unsigned char *in, float *pad, float *out, int cols,
+                       const gaussian_kernel *g)
+{
+    int c, i, k, n, center = g->center, windowsize = g->windowsize;
+    float dot;
+
+    for(c=0; c<center; c++)
+    {
+        i = border_index(c-center, cols);
+        pad[c] = (i < 0) ? 0.0f : (float)in[i];
+        i = border_index(cols+c, cols);
+        pad[center+cols+c] = (i < 0) ? 0.0f : (float)in[i];
     }
+    for(c=0; c+VF32_LANES<=cols; c+=VF32_LANES)
+        vf32_store(&pad[center+c], vf32_load_u8(&in[c]));
+    for(; c<cols; c++)
+        pad[center+c] = (float)in[c];
 
-    for(i=0; i<(*windowsize); i++)
+    n = cols / (2*VF32_LANES) * (2*VF32_LANES);
+    if(windowsize <= MAX_UNROLLED_TAPS)
+        blur_x_taps[windowsize](pad, out, n, g->kernel, windowsize, vf32_dup(1.0f / g->kernelSum));
+    else
+        blur_x_taps_any(pad, out, n, g->kernel, windowsize, vf32_dup(1.0f / g->kernelSum));
+
+    for(c=n; c<cols; c++)
     {
-        x = (float)(i - center);
-        fx = pow(2.71828, -0.5*x*x/(sigma*sigma)) / (sigma * sqrt(6.2831853));
-        (*kernel)[i] = fx;
-        sum += fx;
+        dot = 0.0f;
+        for(k=0; k<windowsize; k++) dot += pad[c+k] * g->kernel[k];
+        out[c] = dot / g->kernelSum;
     }
 
-    for(i=0; i<(*windowsize); i++) (*kernel)[i] /= sum;
+    if(options.border != BORDER_RENORMALISE) return;
 
-    if(VERBOSE)
+    /* Renormalise the pixels whose kernel is cut off by the border. */
+    if(cols > 2*center)
     {
-        printf("The filter coefficients are:\n");
-        for(i=0; i<(*windowsize); i++)
-            printf("kernel[%d] = %f\n", i, (*kernel)[i]);
+        for(c=0; c<center; c++)
+        {
+            out[c] *= g->rescale[c];
+            out[cols-1-c] *= g->rescale[c];
+        }
+    }
+    else
+    {
+        /* The kernel is cut off on both sides. */
+        for(c=0; c<cols; c++)
+            out[c] *= g->kernelSum / (g->kernelSum - g->cut[(c < center) ? center-c : 0]
+                                      - g->cut[(c+center >= cols) ? c+center-cols+1 : 0]);
     }
 }
 
-unsigned short int* gaussian_smooth_neon(unsigned char *image, int rows, int cols, float sigma, int complete_rows)
+/*******************************************************************************
+* PROCEDURE: y_window
+* PURPOSE: Find the x-blurred rows the taps of output row r read: src[k] for
+* tap k, as given by border_index. The taps k0..k1-1 are used, the ones
+* outside are dropped (BORDER_RENORMALISE and BORDER_ZERO).
+*******************************************************************************/
+static void y_window(const gaussian_kernel *g, int r, int rows, int *src, int *k0, int *k1)
 {
-    int r, c, rr, cc,     /* Counter variables. */
-        windowsize,        /* Dimension of the gaussian kernel. */
-        center;            /* Half of the windowsize. */
-    float *tempim,*tempim1,        /* Buffer for separable filter gaussian smoothing. */
-          *kernel,        /* A one dimensional gaussian kernel. */
-          dot,            /* Dot product summing variable. */
-          sum;            /* Sum of the kernel weights variable. */
+    int k;
+
+    *k0 = 0;
+    *k1 = g->windowsize;
+    for(k=0; k<g->windowsize; k++)
+    {
+        src[k] = border_index(r-g->center+k, rows);
+        if(src[k] >= 0) continue;
+        if(k < g->center) *k0 = k+1;
+        else if(k < *k1) *k1 = k;
+    }
+}
+
+/*******************************************************************************
+* PROCEDURE: blur_y_row
+* PURPOSE: Compute one row of the smoothed image from the x-blurred rows
+* win[k0..k1-1]; win[k] is the row tap k of the kernel reads, see y_window.
+* blur_y_taps processes VS16_LANES columns at a time, so every load and store
+* is a unit stride vector access.
+*******************************************************************************/
+static void blur_y_row(float **win, const gaussian_kernel *g, int k0, int k1,
+                       int cols, unsigned short int *out)
+{
+    int c, k, n, windowsize = g->windowsize;
+    const float *kernel = g->kernel;
+    float scale, dot;
+
+    if(options.border == BORDER_RENORMALISE)
+        scale = 90.0f / (g->kernelSum - g->cut[k0] - g->cut[windowsize-k1]);
+    else
+        scale = 90.0f / g->kernelSum;
+
+    n = cols / (2*VF32_LANES) * (2*VF32_LANES);
+    if(k0 == 0 && k1 == windowsize && windowsize <= MAX_UNROLLED_TAPS)
+        blur_y_taps[windowsize](win, kernel, k0, k1, n, out, vf32_dup(scale));
+    else
+        blur_y_taps_any(win, kernel, k0, k1, n, out, vf32_dup(scale));
+
+    for(c=n; c<cols; c++)
+    {
+        dot = 0.0f;
+        for(k=k0; k<k1; k++) dot += win[k][c] * kernel[k];
+        out[c] = (unsigned short int)(dot*scale + 0.5f);
+    }
+}
+
+/*******************************************************************************
+* PROCEDURE: gaussian_smooth_<simd>
+* PURPOSE: Blur an image with a gaussian filter using the vector unit. The x
+* pass blurs each row into tempim with blur_x_row, the y pass works on whole
+* rows of tempim with blur_y_row. Only the first rows rows are smoothed, the
+* result buffer is complete_rows high so that the DSP can fill in the
+* remaining part of the image.
+*******************************************************************************/
+unsigned short int* SIMD_FN(gaussian_smooth)(unsigned char *image, int rows, int cols, float sigma, int complete_rows)
+{
+    const gaussian_kernel *g; /* The kernel and its border tables. */
+    float *tempim,         /* Buffer for separable filter gaussian smoothing. */
+          *pad,            /* Zero-padded float copy of one image row. */
+          **win;           /* The tempim rows around the current output row. */
+    unsigned short int *smoothedim;
+    int r, k, k0, k1, windowsize, *src;
 
     /****************************************************************************
-    * Create a 1-dimensional gaussian smoothing kernel.
+    * Look up the 1-dimensional gaussian smoothing kernel.
     ****************************************************************************/
     if(VERBOSE) printf("   Computing the gaussian smoothing kernel.\n");
-    make_gaussian_kernel(sigma, &kernel, &windowsize);
-    center = windowsize / 2;
-
+    g = get_gaussian_kernel(sigma);
+    windowsize = g->windowsize;
 
     /****************************************************************************
     * Allocate a temporary buffer image and the smoothed image.
@@ -71,175 +312,1229 @@ unsigned short int* gaussian_smooth_neon(unsigned char *image, int rows, int col
         fprintf(stderr, "Error allocating the buffer image.\n");
         exit(1);
     }
-    unsigned short int* smoothedim;
-    unsigned short int* smoothedim1;// just for the pupose of testing 
     if(((smoothedim) = (unsigned short int *) malloc(complete_rows*cols*sizeof(short int))) == NULL)
     {
         fprintf(stderr, "Error allocating the smoothed image.\n");
         exit(1);
     }
- 
+    if(((pad = (float *) malloc((cols+windowsize)*sizeof(float))) == NULL) ||
+       ((win = (float **) malloc(windowsize*sizeof(float *))) == NULL) ||
+       ((src = (int *) malloc(windowsize*sizeof(int))) == NULL))
+    {
+        fprintf(stderr, "Error allocating the line buffers.\n");
+        exit(1);
+    }
+
     /****************************************************************************
     * Blur in the x - direction.
     ****************************************************************************/
-	int loop; 
-	
-	int floop;
-	float * new_image;
-	float *new_image_col;
-	float new_kernel[17];
-
-	for (floop = 0 ; floop < 17 ; floop++)
-	{
-		if(floop == 0 || floop == 16 )
-			new_kernel[floop] = 0 ;
-		else
-			new_kernel [floop] = kernel[floop -1];	
-	}
-	unsigned int new_cols;
-	new_cols=cols+16;
-	unsigned int i, k; 
-	unsigned int a; 
-	unsigned int m; 
-	unsigned int n, j;
-	new_image = (float*)malloc(new_cols*rows*sizeof(float));
-	for( i =0; i<rows; i++){
-		memset(&new_image[i*new_cols],0,8*sizeof(float));
-
-		for( k=0; k<cols;k++){
-			new_image[i*new_cols+8+k] = (float)image[i*cols+k];
-		}
-		memset(&new_image[i*new_cols+8+cols],0,8*sizeof(float));
-	}
-
-  	float32x4_t neon_input;
-	float32x4_t neon_filter;
-	float32x4_t temp_sum;
-	float32x2_t tempUpper;
-	float32x2_t tempLower; 
-	float32_t zero = 0;
-	float32_t temp_output;
-	float Basekernel = 0.0f;
-	float kernelSum = 0.0f;
-
-
-	//printf("\n the ouput image\n");
-	for( a=8; a<=16; a++){
-		Basekernel += new_kernel[a];
-	}
-
-
-	for(m=0; m<rows; m++){
-		for( n=0; n<cols; n++){
-			temp_sum = vdupq_n_f32(0);
-			if(n==0){
-				kernelSum = Basekernel;
-			}
-			else if(n <=8){
-				kernelSum += new_kernel[8-n];
-			}
-			else if(n>=cols-8){
-				kernelSum -=new_kernel[cols-n+8];
-			}
-
-
-			for( j=0; j<4; j++)
-			{
-				int kk=0;
-				if(j>=2)
-				{
-					kk=1;
-				}
-				neon_input = vld1q_f32((float32_t const *)&new_image[m*new_cols+n+j*4+kk]);
-				neon_filter = vld1q_f32((float32_t const *)&new_kernel[j*4+kk]);
-				temp_sum = vmlaq_f32(temp_sum,neon_input,neon_filter);
-			}
-			
-			unsigned int t;
-	
-			for( t=0; t<=3; t++){	
-						
-				temp_output += vgetq_lane_f32(temp_sum,t ); 
-			}
-			temp_output += new_image[m*new_cols+n+8] * new_kernel[8];
-			temp_output /= kernelSum;
-			tempim[m*cols+n] = temp_output;
-			temp_output=0; 
-		}
-	}
-
-	
-    // /****************************************************************************
-    // * Blur in the x - direction.
-    // ****************************************************************************/
+    if(VERBOSE) printf("   Bluring the image in the X-direction.\n");
+    for(r=0; r<rows; r++)
+        blur_x_row(&image[r*cols], pad, &tempim[r*cols], cols, g);
 
     /****************************************************************************
-    * Blur in the y - direction.
+    * Blur in the y - direction, one output row at a time.
     ****************************************************************************/
+    if(VERBOSE) printf("   Bluring the image in the Y-direction.\n");
+    for(r=0; r<rows; r++)
+    {
+        y_window(g, r, rows, src, &k0, &k1);
+        for(k=k0; k<k1; k++)
+            win[k] = &tempim[src[k]*cols];
+        blur_y_row(win, g, k0, k1, cols, &smoothedim[r*cols]);
+    }
 
-    unsigned int new_rows;
-	new_rows=rows+16;
-	new_image_col = (float*)malloc(new_rows*cols*sizeof(float));
-	if(VERBOSE) printf("   Bluring the image in the Y-direction.\n");
-
-	for( i =0; i<cols; i++){//actually nember of new rows are the number of columns here 
-		memset(&new_image_col[i*new_rows],0,8*sizeof(float));
-
-		for( k=0; k<rows;k++){
-			new_image_col[i*new_rows+8+k] = tempim[k*cols+i];
-			//new_image_col[i*new_rows+8+k] = imagetest1[k*cols+i];
-		}
-		memset(&new_image_col[i*new_rows+8+rows],0,8*sizeof(float));
-	}
-
-	Basekernel = 0.0; 
-	for( a=8; a<=16; a++){
-		Basekernel += new_kernel[a];
-	}
-
-	for(m=0; m<cols; m++){
-		for( n=0; n<rows; n++){
-			temp_sum = vdupq_n_f32(0);
-			if(n==0){
-				kernelSum = Basekernel;
-			}
-			else if(n <=8){
-				kernelSum += new_kernel[8-n];
-			}
-			else if(n>=rows-8){
-				kernelSum -=new_kernel[rows-n+8];
-			}
-
-			for( j=0; j<4; j++)
-			{
-				int kk=0;
-				if(j>=2)
-				{
-					kk=1;
-				}
-				neon_input = vld1q_f32((float32_t const *)&new_image_col[m*new_rows+n+j*4+kk]);
-			 	neon_filter = vld1q_f32((float32_t const *)&new_kernel[j*4+kk]);
-				temp_sum = vmlaq_f32(temp_sum,neon_input,neon_filter);
-			}
-			
-			unsigned int t;
-		
-			for( t=0; t<=3; t++){	
-						
-				temp_output += vgetq_lane_f32(temp_sum,t ); 
-
-			}
-			temp_output += new_image_col[m*new_rows+n+8] * new_kernel[8];
-			temp_output = (temp_output * 90) / kernelSum + 0.5;
-			
-			smoothedim[n*cols+m] = (unsigned short int )temp_output;
-			temp_output=0; 
-		}
-	}
-
-	free(new_image);
-	free(new_image_col);
+    free(src);
+    free(win);
+    free(pad);
     free(tempim);
-    free(kernel);
     return smoothedim;
 }
+
+/*******************************************************************************
+* PROCEDURE: div_const
+* PURPOSE: floor(n*mul/d) for non-negative n, with n*mul < 2^32. The quotient is
+* estimated in float (inv = mul/d) and is then off by at most one, which the
+* sign of the remainder n*mul - q*d corrects. The remainder lies in [-d, 2d)
+* so it is exact in wrapping 32-bit arithmetic even when n*mul is not.
+*******************************************************************************/
+static inline vs32 div_const(vs32 n, int mul, int d, vf32 inv)
+{
+    vs32 q = vf32_to_s32(vf32_mul(vs32_to_f32(n), inv));
+    vs32 rem = vs32_sub(mul == 1 ? n : vs32_mul(n, vs32_dup(mul)), vs32_mul(q, vs32_dup(d)));
+
+    q = vs32_add(q, vs32_cmpgt(vs32_dup(0), rem));
+    return vs32_sub(q, vs32_cmpgt(rem, vs32_dup(d-1)));
+}
+
+/*******************************************************************************
+* PROCEDURE: fixed_dot_x
+* PURPOSE: One pixel of the fixed point x pass, with the kernel cut off and
+* renormalised at the image border.
+*******************************************************************************/
+static unsigned char fixed_dot_x(const unsigned char *in, int cols, int c,
+                                 const gaussian_kernel *g)
+{
+    int k, center = g->center;
+    int k0 = (c < center) ? center-c : 0;
+    int k1 = (c+center >= cols) ? cols-c+center : g->windowsize;
+    unsigned int dot = 0;
+
+    for(k=k0; k<k1; k++)
+        dot += in[c-center+k] * g->fixed[k];
+    return dot / (g->fixedSum - g->fixed_cut[k0] - g->fixed_cut[g->windowsize-k1]);
+}
+
+/*******************************************************************************
+* PROCEDURE: gaussian_smooth_fixed_<simd>
+* PURPOSE: Vector version of gaussian_smooth_fixed, bit exact with it and with
+* the DSP. Both passes multiply bytes by 16-bit taps and accumulate in 32 bits,
+* VS16_LANES output pixels at a time; the divisions by the kernel sum are done
+* with div_const. Only the border columns of the x pass, where the kernel sum
+* changes from pixel to pixel, are left to scalar code. In the y pass the sum
+* only depends on the row, so the border rows are vectorised as well.
+*******************************************************************************/
+unsigned short int* SIMD_FN(gaussian_smooth_fixed)(unsigned char *image, int rows, int cols,
+                                                   float sigma, int complete_rows)
+{
+    int r, c, k, k0, k1,   /* Counter variables. */
+        windowsize,        /* Dimension of the gaussian kernel. */
+        center;            /* Half of the windowsize. */
+    unsigned int dot,      /* Dot product summing variable. */
+          sum,             /* Sum of the kernel weights variable. */
+          kernelSum;       /* Sum of the whole kernel. */
+    const gaussian_kernel *g;
+    const unsigned short int *kernel;
+    unsigned short int *smoothedim;
+    unsigned char *tmp, *in, *out;
+    vs32 lo, hi;
+    vs16 pix;
+    vf32 inv;
+
+    g = get_gaussian_kernel(sigma);
+    kernel = g->fixed;
+    kernelSum = g->fixedSum;
+    windowsize = g->windowsize;
+    center = g->center;
+
+    if((tmp = (unsigned char *) malloc(rows*cols* sizeof(unsigned char))) == NULL)
+    {
+        fprintf(stderr, "Error allocating the buffer image.\n");
+        exit(1);
+    }
+    if(((smoothedim) = (unsigned short int *) malloc(complete_rows*cols*sizeof(short int))) == NULL)
+    {
+        fprintf(stderr, "Error allocating the smoothed image.\n");
+        exit(1);
+    }
+
+    /****************************************************************************
+    * Blur in the x - direction.
+    ****************************************************************************/
+    if(VERBOSE) printf("   Bluring the image in the X-direction.\n");
+    inv = vf32_dup(1.0f / (float)kernelSum);
+    for(r=0; r<rows; r++)
+    {
+        in = image + r*cols;
+        out = tmp + r*cols;
+
+        for(c=0; c<cols && c<center; c++)
+            out[c] = fixed_dot_x(in, cols, c, g);
+        for(; c+VS16_LANES<=cols-center; c+=VS16_LANES)
+        {
+            lo = hi = vs32_dup(0);
+            for(k=0; k<windowsize; k++)
+            {
+                pix = vs16_load_u8(in + c-center+k);
+                lo = vs32_mlal_lo_u16(lo, pix, kernel[k]);
+                hi = vs32_mlal_hi_u16(hi, pix, kernel[k]);
+            }
+            vs16_store_u8(out + c, vs16_narrow(div_const(lo, 1, kernelSum, inv),
+                                               div_const(hi, 1, kernelSum, inv)));
+        }
+        for(; c<cols; c++)
+            out[c] = fixed_dot_x(in, cols, c, g);
+    }
+
+    /****************************************************************************
+    * Blur in the y - direction, one output row at a time.
+    ****************************************************************************/
+    if(VERBOSE) printf("   Bluring the image in the Y-direction.\n");
+    for(r=0; r<rows; r++)
+    {
+        k0 = (r < center) ? center-r : 0;
+        k1 = (r+center >= rows) ? rows-r+center : windowsize;
+        sum = kernelSum - g->fixed_cut[k0] - g->fixed_cut[windowsize-k1];
+        inv = vf32_dup(90.0f / (float)sum);
+
+        in = tmp + (r-center+k0)*cols;
+        for(c=0; c+VS16_LANES<=cols; c+=VS16_LANES)
+        {
+            lo = hi = vs32_dup(0);
+            for(k=k0; k<k1; k++)
+            {
+                pix = vs16_load_u8(in + (k-k0)*cols + c);
+                lo = vs32_mlal_lo_u16(lo, pix, kernel[k]);
+                hi = vs32_mlal_hi_u16(hi, pix, kernel[k]);
+            }
+            vs16_store((short int *)smoothedim + r*cols + c,
+                       vs16_narrow(div_const(lo, 90, sum, inv), div_const(hi, 90, sum, inv)));
+        }
+        for(; c<cols; c++)
+        {
+            dot = 0;
+            for(k=k0; k<k1; k++) dot += in[(k-k0)*cols+c] * kernel[k];
+            smoothedim[r*cols+c] = dot*90/sum;
+        }
+    }
+
+    free(tmp);
+    return smoothedim;
+}
+
+/*******************************************************************************
+* PROCEDURE: gaussian_smooth_stream_<simd>
+* PURPOSE: Same filter as gaussian_smooth_<simd>, computed in one pass over
+* the image. Only a ring of windowsize x-blurred rows is kept: each input row
+* is blurred into the ring, and as soon as the rows below an output row are
+* in the ring that output row is written. The scratch memory is about
+* windowsize*cols floats instead of three full size float images, so it
+* stays in the cache.
+*******************************************************************************/
+unsigned short int* SIMD_FN(gaussian_smooth_stream)(unsigned char *image, int rows, int cols,
+                                                    float sigma, int complete_rows)
+{
+    int r, o, k, k0, k1,   /* Counter variables. */
+        windowsize,        /* Dimension of the gaussian kernel. */
+        center,            /* Half of the windowsize. */
+        *src;              /* The image rows the taps of an output row read. */
+    const gaussian_kernel *g; /* The kernel and its border tables. */
+    float *ring,           /* The last windowsize x-blurred rows. */
+          *pad,            /* Zero-padded float copy of one image row. */
+          **win;           /* The ring rows around the current output row. */
+    unsigned short int *smoothedim;
+
+    if(VERBOSE) printf("   Computing the gaussian smoothing kernel.\n");
+    g = get_gaussian_kernel(sigma);
+    windowsize = g->windowsize;
+    center = g->center;
+
+    if(((ring = (float *) malloc(windowsize*cols*sizeof(float))) == NULL) ||
+       ((pad = (float *) malloc((cols+windowsize)*sizeof(float))) == NULL) ||
+       ((win = (float **) malloc(windowsize*sizeof(float *))) == NULL) ||
+       ((src = (int *) malloc(windowsize*sizeof(int))) == NULL))
+    {
+        fprintf(stderr, "Error allocating the line buffers.\n");
+        exit(1);
+    }
+    if(((smoothedim) = (unsigned short int *) malloc(complete_rows*cols*sizeof(short int))) == NULL)
+    {
+        fprintf(stderr, "Error allocating the smoothed image.\n");
+        exit(1);
+    }
+
+    /****************************************************************************
+    * Output row o needs the x-blurred rows o-center .. o+center, so it is
+    * written once row r = o+center has been blurred into the ring. The rows a
+    * clamped or mirrored border reads lie within that window as well.
+    ****************************************************************************/
+    for(r=0; r<rows+center; r++)
+    {
+        if(r < rows)
+            blur_x_row(&image[r*cols], pad, &ring[(r % windowsize)*cols], cols, g);
+
+        o = r - center;
+        if(o < 0) continue;
+
+        y_window(g, o, rows, src, &k0, &k1);
+        for(k=k0; k<k1; k++)
+            win[k] = &ring[(src[k] % windowsize)*cols];
+        blur_y_row(win, g, k0, k1, cols, &smoothedim[o*cols]);
+    }
+
+    free(src);
+    free(win);
+    free(pad);
+    free(ring);
+    return smoothedim;
+}
+
+/*******************************************************************************
+* PROCEDURE: iir_step
+* PURPOSE: One step of the third order recursion of gaussian_smooth_iir. The
+* term in w1, the value computed in the previous step, is added last so only
+* one multiply-add is on the dependency chain from step to step.
+*******************************************************************************/
+static inline vf32 iir_step(vf32 x, vf32 w1, vf32 w2, vf32 w3, const vf32 *a)
+{
+    return vf32_mla(vf32_mla(vf32_mla(vf32_mul(a[0], x), a[3], w3), a[2], w2), a[1], w1);
+}
+
+/*******************************************************************************
+* PROCEDURE: gaussian_smooth_iir_<simd>
+* PURPOSE: Vector version of gaussian_smooth_iir. Along the rows the recursion
+* runs for VF32_LANES rows at once, on a block of rows that is stored column
+* by column in blk. Down the columns it runs for 2*VF32_LANES columns at
+* once, in row order. The work per pixel does not depend on sigma.
+*******************************************************************************/
+unsigned short int* SIMD_FN(gaussian_smooth_iir)(unsigned char *image, int rows, int cols,
+                                                 float sigma, int complete_rows)
+{
+    const gaussian_kernel *g;
+    int r, c, i, row[VF32_LANES];
+    float coef[4], w0, w1, w2, w3;
+    float *tempim,         /* The image filtered in the x-direction. */
+          *blk;            /* VF32_LANES rows of it, stored column by column. */
+    unsigned short int *smoothedim;
+    vf32 a[4], x0, x1, x2, x3, y0, y1, y2, y3, boost = vf32_dup(90.0f),
+         half = vf32_dup(0.5f), zero = vf32_dup(0.0f);
+
+    g = get_gaussian_kernel(sigma);
+    for(i=0; i<4; i++) coef[i] = g->iir[i];
+    for(i=0; i<4; i++) a[i] = vf32_dup(coef[i]);
+
+    if(((tempim = (float *) malloc(rows*cols*sizeof(float))) == NULL) ||
+       ((blk = (float *) malloc(cols*VF32_LANES*sizeof(float))) == NULL))
+    {
+        fprintf(stderr, "Error allocating the buffer image.\n");
+        exit(1);
+    }
+    if(((smoothedim) = (unsigned short int *) malloc(complete_rows*cols*sizeof(short int))) == NULL)
+    {
+        fprintf(stderr, "Error allocating the smoothed image.\n");
+        exit(1);
+    }
+
+    /****************************************************************************
+    * Filter in the x - direction, forwards and then backwards. The lanes past
+    * the last row repeat it and are not stored.
+    ****************************************************************************/
+    if(VERBOSE) printf("   Filtering the image in the X-direction.\n");
+    for(r=0; r<rows; r+=VF32_LANES)
+    {
+        for(i=0; i<VF32_LANES; i++) row[i] = (r+i < rows) ? r+i : rows-1;
+        for(c=0; c<cols; c++)
+            for(i=0; i<VF32_LANES; i++)
+                blk[c*VF32_LANES+i] = image[row[i]*cols+c];
+
+        x1 = x2 = x3 = vf32_load(&blk[0]);
+        for(c=0; c<cols; c++)
+        {
+            x0 = iir_step(vf32_load(&blk[c*VF32_LANES]), x1, x2, x3, a);
+            vf32_store(&blk[c*VF32_LANES], x0);
+            x3 = x2; x2 = x1; x1 = x0;
+        }
+        x1 = x2 = x3 = vf32_load(&blk[(cols-1)*VF32_LANES]);
+        for(c=cols-1; c>=0; c--)
+        {
+            x0 = iir_step(vf32_load(&blk[c*VF32_LANES]), x1, x2, x3, a);
+            vf32_store(&blk[c*VF32_LANES], x0);
+            x3 = x2; x2 = x1; x1 = x0;
+        }
+
+        for(i=0; i<VF32_LANES && r+i<rows; i++)
+            for(c=0; c<cols; c++)
+                tempim[(r+i)*cols+c] = blk[c*VF32_LANES+i];
+    }
+
+    /****************************************************************************
+    * Filter in the y - direction, forwards and then backwards.
+    ****************************************************************************/
+    if(VERBOSE) printf("   Filtering the image in the Y-direction.\n");
+    for(c=0; c+2*VF32_LANES<=cols; c+=2*VF32_LANES)
+    {
+        float *p = &tempim[c];
+
+        x1 = x2 = x3 = vf32_load(p);
+        y1 = y2 = y3 = vf32_load(p+VF32_LANES);
+        for(r=0; r<rows; r++, p+=cols)
+        {
+            x0 = iir_step(vf32_load(p), x1, x2, x3, a);
+            y0 = iir_step(vf32_load(p+VF32_LANES), y1, y2, y3, a);
+            vf32_store(p, x0);
+            vf32_store(p+VF32_LANES, y0);
+            x3 = x2; x2 = x1; x1 = x0;
+            y3 = y2; y2 = y1; y1 = y0;
+        }
+
+        p -= cols;
+        x2 = x3 = x1;
+        y2 = y3 = y1;
+        for(r=rows-1; r>=0; r--, p-=cols)
+        {
+            x0 = iir_step(vf32_load(p), x1, x2, x3, a);
+            y0 = iir_step(vf32_load(p+VF32_LANES), y1, y2, y3, a);
+            x3 = x2; x2 = x1; x1 = x0;
+            y3 = y2; y2 = y1; y1 = y0;
+            x0 = vf32_max(vf32_mla(half, x0, boost), zero);
+            y0 = vf32_max(vf32_mla(half, y0, boost), zero);
+            vs16_store((short int *)&smoothedim[r*cols+c],
+                       vs16_narrow(vf32_to_s32(x0), vf32_to_s32(y0)));
+        }
+    }
+    for(; c<cols; c++)
+    {
+        w1 = w2 = w3 = tempim[c];
+        for(r=0; r<rows; r++)
+        {
+            w0 = coef[0]*tempim[r*cols+c] + coef[1]*w1 + coef[2]*w2 + coef[3]*w3;
+            tempim[r*cols+c] = w0;
+            w3 = w2; w2 = w1; w1 = w0;
+        }
+        w2 = w3 = w1;
+        for(r=rows-1; r>=0; r--)
+        {
+            w0 = coef[0]*tempim[r*cols+c] + coef[1]*w1 + coef[2]*w2 + coef[3]*w3;
+            smoothedim[r*cols+c] = (w0 > 0.0f) ? (unsigned short int)(w0*90.0f + 0.5f) : 0;
+            w3 = w2; w2 = w1; w1 = w0;
+        }
+    }
+
+    free(blk);
+    free(tempim);
+    return smoothedim;
+}
+
+/*******************************************************************************
+* PROCEDURE: diff_border_row
+* PURPOSE: out = next - prev for a border row of the y-derivative. next and
+* prev are the rows the stencil reads, NULL where options.border reads zeros.
+*******************************************************************************/
+static void diff_border_row(const short int *next, const short int *prev, short int *out,
+                            int cols)
+{
+    int c;
+    vs16 zero = vs16_dup(0);
+
+    for(c=0; c+VS16_LANES<=cols; c+=VS16_LANES)
+        vs16_store(&out[c], vs16_sub(next ? vs16_load(&next[c]) : zero,
+                                     prev ? vs16_load(&prev[c]) : zero));
+    for(; c<cols; c++)
+        out[c] = (next ? next[c] : 0) - (prev ? prev[c] : 0);
+}
+
+/*******************************************************************************
+* PROCEDURE: direction_row
+* PURPOSE: The gradient_octant codes of n pixels, found with vector compares:
+* each bit of the code is cleared where its test fails, the x-major one where
+* |gy| > |gx| or gx == gy < 0. -32768, which the derivatives of the smoothed
+* image never reach, has no 16-bit absolute value.
+*******************************************************************************/
+static void direction_row(const short int *dx, const short int *dy, int n, unsigned char *dir)
+{
+    int c;
+    vs16 gx, gy, xneg, yneg, ymajor, zero, xbit, ybit, majorbit, all;
+
+    zero = vs16_dup(0);
+    xbit = vs16_dup(OCTANT_GX_POSITIVE);
+    ybit = vs16_dup(OCTANT_GY_POSITIVE);
+    majorbit = vs16_dup(OCTANT_X_MAJOR);
+    all = vs16_dup(OCTANT_GX_POSITIVE | OCTANT_GY_POSITIVE | OCTANT_X_MAJOR);
+
+    for(c=0; c+VS16_LANES<=n; c+=VS16_LANES)
+    {
+        gx = vs16_load(&dx[c]);
+        gy = vs16_load(&dy[c]);
+        xneg = vs16_cmpgt(zero, gx);
+        yneg = vs16_cmpgt(zero, gy);
+        ymajor = vs16_or(vs16_cmpgt(vs16_abs(gy), vs16_abs(gx)),
+                         vs16_and(xneg, vs16_cmpeq(gx, gy)));
+
+        vs16_store_u8(&dir[c], vs16_sub(all, vs16_or(vs16_and(xneg, xbit),
+                                              vs16_or(vs16_and(yneg, ybit),
+                                                      vs16_and(ymajor, majorbit)))));
+    }
+    for(; c<n; c++)
+        dir[c] = gradient_octant(dx[c], dy[c]);
+}
+
+/*******************************************************************************
+* PROCEDURE: weigh
+* PURPOSE: (side*(a + c) + middle*b + round) >> shift in 32-bit lanes, the
+* sum of weighted_derivative_row.
+*******************************************************************************/
+static inline vs16 weigh(vs16 a, vs16 b, vs16 c, vs16 side, vs16 middle, vs32 round,
+                         int shift)
+{
+    vs32 lo, hi;
+
+    lo = vs32_add(vs32_add(vs32_mull_lo(a, side), vs32_mull_lo(c, side)),
+                  vs32_add(vs32_mull_lo(b, middle), round));
+    hi = vs32_add(vs32_add(vs32_mull_hi(a, side), vs32_mull_hi(c, side)),
+                  vs32_add(vs32_mull_hi(b, middle), round));
+    return vs16_narrow(vs32_shr(lo, shift), vs32_shr(hi, shift));
+}
+
+/*******************************************************************************
+* PROCEDURE: weighted_row
+* PURPOSE: Vector version of weighted_derivative_row for a whole row. The
+* three rows the x-differences are taken of and the row of y-differences
+* are read a vector at a time, their neighbours put together with vs16_prev
+* and vs16_next as derivative_row does. The border rows and columns, and the
+* columns past the last whole vector, are left to weighted_derivative_row.
+*******************************************************************************/
+static void weighted_row(const short int *smoothedim, int r, int rows, int cols,
+                         short int *dx, short int *dy)
+{
+    int c = 0, side, middle, shift;
+    const short int *s = &smoothedim[r*cols];
+    vs16 ap, ac, an, bp, bc, bn, np, nc, nn, ep, ec, en, wside, wmiddle;
+    vs32 round;
+
+    shift = operator_weights(&side, &middle);
+    if(r > 0 && r < rows-1 && cols >= 2*VS16_LANES)
+    {
+        wside = vs16_dup(side);
+        wmiddle = vs16_dup(middle);
+        round = vs32_dup(1 << (shift-1));
+
+        /* Lane 0 of the first vector is a border pixel, the p vectors are dummies. */
+        ap = ac = vs16_load(&s[-cols]);
+        bp = bc = vs16_load(s);
+        np = nc = vs16_load(&s[cols]);
+        ep = ec = vs16_sub(nc, ac);
+        for(; c+2*VS16_LANES<=cols; c+=VS16_LANES)
+        {
+            an = vs16_load(&s[c+VS16_LANES-cols]);
+            bn = vs16_load(&s[c+VS16_LANES]);
+            nn = vs16_load(&s[c+VS16_LANES+cols]);
+            en = vs16_sub(nn, an);
+
+            vs16_store(&dx[c], weigh(vs16_sub(vs16_next(ac, an), vs16_prev(ap, ac)),
+                                     vs16_sub(vs16_next(bc, bn), vs16_prev(bp, bc)),
+                                     vs16_sub(vs16_next(nc, nn), vs16_prev(np, nc)),
+                                     wside, wmiddle, round, shift));
+            vs16_store(&dy[c], weigh(vs16_prev(ep, ec), ec, vs16_next(ec, en),
+                                     wside, wmiddle, round, shift));
+            ap = ac; ac = an;
+            bp = bc; bc = bn;
+            np = nc; nc = nn;
+            ep = ec; ec = en;
+        }
+    }
+    weighted_derivative_row(smoothedim, r, rows, cols, c, cols, dx, dy);
+    if(c > 0) weighted_derivative_row(smoothedim, r, rows, cols, 0, 1, dx, dy);
+}
+
+/*******************************************************************************
+* PROCEDURE: derivative_row
+* PURPOSE: Row r of the derivatives, into dx and dy. For dx the row is read
+* once, a vector at a time: the neighbours s[c-1] and s[c+1] of a vector are
+* put together from it and the vectors before and after it with vs16_prev and
+* vs16_next. dy is the difference of the rows below and above. The first and
+* last column go through border_difference, the first and last row through
+* diff_border_row. GRADIENT_SOBEL and GRADIENT_SCHARR go through weighted_row.
+* Unless dir is NULL the direction codes are written too.
+*******************************************************************************/
+static void derivative_row(const short int *smoothedim, int r, int rows, int cols,
+                           short int *dx, short int *dy, unsigned char *dir)
+{
+    int c = 0;
+    const short int *s = &smoothedim[r*cols];
+    vs16 prev, cur, next;
+
+    if(options.gradient == GRADIENT_SOBEL || options.gradient == GRADIENT_SCHARR)
+    {
+        weighted_row(smoothedim, r, rows, cols, dx, dy);
+        if(dir != NULL) direction_row(dx, dy, cols, dir);
+        return;
+    }
+
+    if(cols >= 2*VS16_LANES)
+    {
+        /* Lane 0 of the first vector is a border pixel, prev is a dummy. */
+        prev = cur = vs16_load(s);
+        for(; c+2*VS16_LANES<=cols; c+=VS16_LANES)
+        {
+            next = vs16_load(&s[c+VS16_LANES]);
+            vs16_store(&dx[c], vs16_sub(vs16_next(cur, next), vs16_prev(prev, cur)));
+            prev = cur;
+            cur = next;
+        }
+    }
+    for(c=(c > 1) ? c : 1; c<(cols-1); c++)
+        dx[c] = s[c+1] - s[c-1];
+    dx[0] = border_difference(s, 0, cols, 1);
+    dx[cols-1] = border_difference(s, cols-1, cols, 1);
+
+    if(r == 0 || r == rows-1)
+    {
+        diff_border_row(border_row(smoothedim, r+1, r, rows, cols),
+                        border_row(smoothedim, r-1, r, rows, cols), dy, cols);
+    }
+    else
+    {
+        for(c=0; c+VS16_LANES<=cols; c+=VS16_LANES)
+            vs16_store(&dy[c], vs16_sub(vs16_load(&s[c+cols]), vs16_load(&s[c-cols])));
+        for(; c<cols; c++)
+            dy[c] = s[c+cols] - s[c-cols];
+    }
+
+    if(dir != NULL) direction_row(dx, dy, cols, dir);
+}
+
+/*******************************************************************************
+* PROCEDURE: derrivative_x_y_<simd>
+* PURPOSE: Vectorised version of derrivative_x_y. Both derivative images are
+* written in one sweep down the rows with derivative_row, so every access is
+* a unit stride one.
+*******************************************************************************/
+void SIMD_FN(derrivative_x_y)(short int *smoothedim, int rows, int cols,
+        short int **delta_x, short int **delta_y)
+{
+    int r;
+
+    /****************************************************************************
+    * Allocate images to store the derivatives.
+    ****************************************************************************/
+    if(((*delta_x) = (short *) malloc(rows*cols* sizeof(short))) == NULL){
+        fprintf(stderr, "Error allocating the delta_x image.\n");
+        exit(1);
+    }
+    if(((*delta_y) = (short *) malloc(rows*cols* sizeof(short))) == NULL){
+        fprintf(stderr, "Error allocating the delta_y image.\n");
+        exit(1);
+    }
+
+    for(r=0; r<rows; r++)
+        derivative_row(smoothedim, r, rows, cols, &(*delta_x)[r*cols], &(*delta_y)[r*cols], NULL);
+}
+
+/*******************************************************************************
+* PROCEDURE: store_derivative
+* PURPOSE: derivative_round for 2*VF32_LANES values, stored as shorts.
+*******************************************************************************/
+static inline void store_derivative(short int *out, vf32 lo, vf32 hi)
+{
+    vf32 limit = vf32_dup(DERIVATIVE_LIMIT), zero = vf32_dup(0.0f),
+         up = vf32_dup(0.5f), down = vf32_dup(-0.5f);
+
+    lo = vf32_max(vf32_min(lo, limit), vf32_sub(zero, limit));
+    hi = vf32_max(vf32_min(hi, limit), vf32_sub(zero, limit));
+    lo = vf32_add(lo, vf32_select(vf32_cmplt(lo, zero), down, up));
+    hi = vf32_add(hi, vf32_select(vf32_cmplt(hi, zero), down, up));
+    vs16_store(out, vs16_narrow(vf32_to_s32(lo), vf32_to_s32(hi)));
+}
+
+/*******************************************************************************
+* PROCEDURE: dog_y_row
+* PURPOSE: The y pass of derivative_of_gaussian for one row: dx is the
+* gaussian of the slope rows, dy the derivative of the smooth rows, over the
+* taps k0..k1-1. Both are summed 2*VF32_LANES columns at a time.
+*******************************************************************************/
+static void dog_y_row(float **slope, float **smooth, const gaussian_kernel *g, int k0, int k1,
+                      int cols, short int *dx, short int *dy)
+{
+    int c, k;
+    float dot, ddot;
+    vf32 xlo, xhi, ylo, yhi, tap, dtap, scale = vf32_dup(1.0f / g->kernelSum);
+
+    for(c=0; c+2*VF32_LANES<=cols; c+=2*VF32_LANES)
+    {
+        xlo = xhi = ylo = yhi = vf32_dup(0.0f);
+        for(k=k0; k<k1; k++)
+        {
+            tap = vf32_dup(g->kernel[k]);
+            dtap = vf32_dup(g->derivative[k]);
+            xlo = vf32_mla(xlo, vf32_load(&slope[k][c]), tap);
+            xhi = vf32_mla(xhi, vf32_load(&slope[k][c+VF32_LANES]), tap);
+            ylo = vf32_mla(ylo, vf32_load(&smooth[k][c]), dtap);
+            yhi = vf32_mla(yhi, vf32_load(&smooth[k][c+VF32_LANES]), dtap);
+        }
+        store_derivative(&dx[c], vf32_mul(xlo, scale), vf32_mul(xhi, scale));
+        store_derivative(&dy[c], ylo, yhi);
+    }
+    for(; c<cols; c++)
+    {
+        dot = ddot = 0.0f;
+        for(k=k0; k<k1; k++)
+        {
+            dot += slope[k][c] * g->kernel[k];
+            ddot += smooth[k][c] * g->derivative[k];
+        }
+        dx[c] = derivative_round(dot / g->kernelSum);
+        dy[c] = derivative_round(ddot);
+    }
+}
+
+/*******************************************************************************
+* PROCEDURE: dog_x_row
+* PURPOSE: The x pass of derivative_of_gaussian for one row. The row is
+* padded like blur_x_row does, through clamped_border_index, and the
+* blur_x_taps of the window size run over it once with the gaussian into
+* smooth and once with its derivative into slope.
+*******************************************************************************/
+static void dog_x_row(const unsigned char *in, float *pad, float *smooth, float *slope,
+                      int cols, const gaussian_kernel *g)
+{
+    int c, i, k, n, center = g->center, windowsize = g->windowsize;
+    float dot, ddot;
+    blur_x_taps_fn taps;
+
+    for(c=0; c<center; c++)
+    {
+        i = clamped_border_index(c-center, cols);
+        pad[c] = (i < 0) ? 0.0f : (float)in[i];
+        i = clamped_border_index(cols+c, cols);
+        pad[center+cols+c] = (i < 0) ? 0.0f : (float)in[i];
+    }
+    for(c=0; c+VF32_LANES<=cols; c+=VF32_LANES)
+        vf32_store(&pad[center+c], vf32_load_u8(&in[c]));
+    for(; c<cols; c++)
+        pad[center+c] = (float)in[c];
+
+    n = cols / (2*VF32_LANES) * (2*VF32_LANES);
+    taps = (windowsize <= MAX_UNROLLED_TAPS) ? blur_x_taps[windowsize] : blur_x_taps_any;
+    taps(pad, smooth, n, g->kernel, windowsize, vf32_dup(1.0f / g->kernelSum));
+    taps(pad, slope, n, g->derivative, windowsize, vf32_dup(1.0f));
+
+    for(c=n; c<cols; c++)
+    {
+        dot = ddot = 0.0f;
+        for(k=0; k<windowsize; k++)
+        {
+            dot += pad[c+k] * g->kernel[k];
+            ddot += pad[c+k] * g->derivative[k];
+        }
+        smooth[c] = dot / g->kernelSum;
+        slope[c] = ddot;
+    }
+}
+
+/*******************************************************************************
+* PROCEDURE: derivative_of_gaussian_<simd>
+* PURPOSE: Vectorised version of derivative_of_gaussian, in one pass over the
+* image like gaussian_smooth_stream_<simd>: each row goes through dog_x_row
+* into two rings of windowsize rows, and an output row is written with
+* dog_y_row as soon as the rows below it are in the rings.
+*******************************************************************************/
+void SIMD_FN(derivative_of_gaussian)(unsigned char *image, int rows, int cols, float sigma,
+                                     short int **delta_x, short int **delta_y)
+{
+    const gaussian_kernel *g;
+    float *smooth,         /* The last windowsize rows blurred with the gaussian. */
+          *slope,          /* And convolved with its derivative. */
+          *pad,            /* Padded float copy of one image row. */
+          **swin, **dwin;  /* The ring rows under the taps of an output row. */
+    int r, o, k, i, k0, k1, windowsize, center;
+
+    g = get_gaussian_kernel(sigma);
+    windowsize = g->windowsize;
+    center = g->center;
+
+    if(((smooth = (float *) malloc(windowsize*cols*sizeof(float))) == NULL) ||
+       ((slope = (float *) malloc(windowsize*cols*sizeof(float))) == NULL) ||
+       ((pad = (float *) malloc((cols+windowsize)*sizeof(float))) == NULL) ||
+       ((swin = (float **) malloc(windowsize*sizeof(float *))) == NULL) ||
+       ((dwin = (float **) malloc(windowsize*sizeof(float *))) == NULL))
+    {
+        fprintf(stderr, "Error allocating the line buffers.\n");
+        exit(1);
+    }
+    if((((*delta_x) = (short *) malloc(rows*cols*sizeof(short))) == NULL) ||
+       (((*delta_y) = (short *) malloc(rows*cols*sizeof(short))) == NULL))
+    {
+        fprintf(stderr, "Error allocating the derivative images.\n");
+        exit(1);
+    }
+
+    /****************************************************************************
+    * Output row o needs the rows o-center .. o+center, the clamped and
+    * mirrored ones included, so it is written once row o+center is in the
+    * rings. Only BORDER_ZERO drops taps, and only at the ends of the window.
+    ****************************************************************************/
+    for(r=0; r<rows+center; r++)
+    {
+        if(r < rows)
+            dog_x_row(&image[r*cols], pad, &smooth[(r % windowsize)*cols],
+                      &slope[(r % windowsize)*cols], cols, g);
+
+        o = r - center;
+        if(o < 0) continue;
+
+        k0 = windowsize;
+        k1 = 0;
+        for(k=0; k<windowsize; k++)
+        {
+            i = clamped_border_index(o-center+k, rows);
+            if(i < 0) continue;
+            if(k < k0) k0 = k;
+            k1 = k+1;
+            swin[k] = &smooth[(i % windowsize)*cols];
+            dwin[k] = &slope[(i % windowsize)*cols];
+        }
+        dog_y_row(dwin, swin, g, k0, k1, cols, &(*delta_x)[o*cols], &(*delta_y)[o*cols]);
+    }
+
+    free(dwin);
+    free(swin);
+    free(pad);
+    free(slope);
+    free(smooth);
+}
+
+/*******************************************************************************
+* PROCEDURE: rounded_root
+* PURPOSE: (short)(0.5 + sqrt(N)) for N = (float)sq1 + (float)sq2 as the scalar
+* magnitude_x_y computes it. N is a whole number and the result is the m with
+* m*m - m < N <= m*m + m. The float square root (on NEON an estimate refined
+* by Newton iterations) is well within 0.125 of sqrt(N), so
+* trunc(sqrt + 0.375) is m or m - 1 and one integer compare tells which.
+* Exact as long as the magnitude fits in a short.
+*******************************************************************************/
+static inline vs32 rounded_root(vs32 sq1, vs32 sq2)
+{
+    vf32 sum;
+    vs32 n, m;
+
+    sum = vf32_add(vs32_to_f32(sq1), vs32_to_f32(sq2));
+    n = vf32_to_s32(sum);
+    m = vf32_to_s32(vf32_add(vf32_sqrt(sum), vf32_dup(0.375f)));
+
+    /* The compare is -1 where m is one short. */
+    return vs32_sub(m, vs32_cmpgt(n, vs32_add(vs32_mul(m, m), m)));
+}
+
+/*******************************************************************************
+* PROCEDURE: magnitude_x_y_<simd>
+* PURPOSE: Vectorised version of magnitude_x_y, bit-exact with the scalar
+* code. The squares are formed with a widening multiply and rounded to the
+* nearest integer root by rounded_root. The octagonal approximation is
+* computed on the shorts directly.
+*******************************************************************************/
+void SIMD_FN(magnitude_x_y)(short int *delta_x, short int *delta_y, int rows, int cols,
+                   short int *magnitude)
+{
+    int pos, n, sq1, sq2;
+    vs16 dx, dy, big, small;
+
+    n = rows * cols;
+    if(options.magnitude == MAGNITUDE_OCTAGONAL)
+    {
+        for(pos=0; pos+VS16_LANES<=n; pos+=VS16_LANES)
+        {
+            dx = vs16_abs(vs16_load(&delta_x[pos]));
+            dy = vs16_abs(vs16_load(&delta_y[pos]));
+            big = vs16_max(dx, dy);
+            small = vs16_min(dx, dy);
+
+            vs16_store(&magnitude[pos], vs16_max(big,
+                vs16_add(vs16_sub(big, vs16_shr(big, 3)),
+                         vs16_add(vs16_shr(small, 1), vs16_shr(small, 5)))));
+        }
+        for(; pos<n; pos++)
+            magnitude[pos] = octagonal_magnitude(delta_x[pos], delta_y[pos]);
+        return;
+    }
+
+    for(pos=0; pos+VS16_LANES<=n; pos+=VS16_LANES)
+    {
+        dx = vs16_load(&delta_x[pos]);
+        dy = vs16_load(&delta_y[pos]);
+
+        vs16_store(&magnitude[pos], vs16_narrow(
+            rounded_root(vs32_mull_lo(dx, dx), vs32_mull_lo(dy, dy)),
+            rounded_root(vs32_mull_hi(dx, dx), vs32_mull_hi(dy, dy))));
+    }
+    for(; pos<n; pos++)
+    {
+        sq1 = (int)delta_x[pos] * (int)delta_x[pos];
+        sq2 = (int)delta_y[pos] * (int)delta_y[pos];
+        magnitude[pos] = (short)(0.5 + sqrt((float)sq1 + (float)sq2));
+    }
+}
+
+/*******************************************************************************
+* PROCEDURE: atan_unit
+* PURPOSE: atan(t) for 0 <= t <= 1 by the odd polynomial of Abramowitz and
+* Stegun 4.4.47, which is within 1e-5 rad of it.
+*******************************************************************************/
+static inline vf32 atan_unit(vf32 t)
+{
+    vf32 t2 = vf32_mul(t, t), p;
+
+    p = vf32_mla(vf32_dup(-0.0851330f), t2, vf32_dup(0.0208351f));
+    p = vf32_mla(vf32_dup(0.1801410f), t2, p);
+    p = vf32_mla(vf32_dup(-0.3302995f), t2, p);
+    p = vf32_mla(vf32_dup(0.9998660f), t2, p);
+    return vf32_mul(t, p);
+}
+
+/*******************************************************************************
+* PROCEDURE: vector_angle
+* PURPOSE: angle_radians of integer valued x and y, branch free: the angle of
+* the smaller over the larger component, reflected into the octant and
+* quadrant of (x,y) with selects. As the components are whole numbers the
+* larger one is at least 1 unless both are 0, which gives 0 like
+* angle_radians.
+*******************************************************************************/
+static inline vf32 vector_angle(vf32 x, vf32 y)
+{
+    vf32 zero = vf32_dup(0.0f), ax = vf32_abs(x), ay = vf32_abs(y), ang;
+    vs32 yneg = vf32_cmplt(y, zero);
+
+    ang = atan_unit(vf32_div(vf32_min(ax, ay), vf32_max(vf32_max(ax, ay), vf32_dup(1.0f))));
+    ang = vf32_select(vf32_cmplt(ax, ay), vf32_sub(vf32_dup((float)(M_PI/2)), ang), ang);
+    ang = vf32_select(yneg, vf32_sub(zero, ang), ang);
+
+    return vf32_select(vf32_cmplt(x, zero), vf32_sub(vf32_dup((float)M_PI), ang),
+                       vf32_select(yneg, vf32_add(vf32_dup((float)(2*M_PI)), ang), ang));
+}
+
+/*******************************************************************************
+* PROCEDURE: radian_direction_<simd>
+* PURPOSE: Vectorised version of radian_direction, 2*VF32_LANES pixels at a
+* time. The angle is within 1e-4 rad of angle_radians (the polynomial is
+* within 1e-5, the NEON reciprocal adds a few float roundings), in the same
+* range 0 <= angle < 2*PI and with the same xdirtag and ydirtag.
+*******************************************************************************/
+void SIMD_FN(radian_direction)(short int *delta_x, short int *delta_y, int rows,
+                               int cols, float **dir_radians, int xdirtag, int ydirtag)
+{
+    int pos, n;
+    float *dirim, xsign, ysign;
+    vs16 dx, dy;
+    vf32 vxsign, vysign;
+
+    n = rows * cols;
+    if((dirim = (float *) malloc(n* sizeof(float))) == NULL)
+    {
+        fprintf(stderr, "Error allocating the gradient direction image.\n");
+        exit(1);
+    }
+    *dir_radians = dirim;
+
+    xsign = (xdirtag == 1) ? -1.0f : 1.0f;
+    ysign = (ydirtag == -1) ? -1.0f : 1.0f;
+    vxsign = vf32_dup(xsign);
+    vysign = vf32_dup(ysign);
+
+    for(pos=0; pos+VS16_LANES<=n; pos+=VS16_LANES)
+    {
+        dx = vs16_load(&delta_x[pos]);
+        dy = vs16_load(&delta_y[pos]);
+
+        vf32_store(&dirim[pos], vector_angle(vf32_mul(vs32_to_f32(vs32_widen_lo(dx)), vxsign),
+                                             vf32_mul(vs32_to_f32(vs32_widen_lo(dy)), vysign)));
+        vf32_store(&dirim[pos+VF32_LANES],
+                   vector_angle(vf32_mul(vs32_to_f32(vs32_widen_hi(dx)), vxsign),
+                                vf32_mul(vs32_to_f32(vs32_widen_hi(dy)), vysign)));
+    }
+    for(; pos<n; pos++)
+        dirim[pos] = angle_radians(xsign * delta_x[pos], ysign * delta_y[pos]);
+}
+
+/*******************************************************************************
+* PROCEDURE: nms_half
+* PURPOSE: The sign of N = p + q, see nms_row, as masks: pos and neg where it
+* is above and below 0 by more than Heath's float rounding can move it,
+* exact0 where p and q are both 0.
+*******************************************************************************/
+static inline void nms_half(vs32 p, vs32 q, vs32 *pos, vs32 *neg, vs32 *exact0)
+{
+    vs32 n, s, t;
+
+    n = vs32_add(p, q);
+    s = vs32_add(vs32_abs(p), vs32_abs(q));
+    t = vs32_shr(s, 20);
+
+    *pos = vs32_cmpgt(n, t);
+    *neg = vs32_cmpgt(vs32_sub(vs32_dup(0), t), n);
+    *exact0 = vs32_cmpeq(s, vs32_dup(0));
+}
+
+/*******************************************************************************
+* PROCEDURE: nms_side
+* PURPOSE: nms_half of big*(a - m) + small*(d - a), for all VS16_LANES lanes.
+*******************************************************************************/
+static inline void nms_side(vs16 big, vs16 small, vs16 a, vs16 d, vs16 m,
+                            vs16 *pos, vs16 *neg, vs16 *exact0)
+{
+    vs16 am = vs16_sub(a, m), da = vs16_sub(d, a);
+    vs32 plo, nlo, zlo, phi, nhi, zhi;
+
+    nms_half(vs32_mull_lo(big, am), vs32_mull_lo(small, da), &plo, &nlo, &zlo);
+    nms_half(vs32_mull_hi(big, am), vs32_mull_hi(small, da), &phi, &nhi, &zhi);
+
+    *pos = vs16_narrow(plo, phi);
+    *neg = vs16_narrow(nlo, nhi);
+    *exact0 = vs16_narrow(zlo, zhi);
+}
+
+/*******************************************************************************
+* PROCEDURE: nms_row
+* PURPOSE: non_max_supp_row for VS16_LANES pixels at a time, without branches
+* or divisions. Each of Heath's eight cases interpolates between an axis
+* neighbour A and a diagonal neighbour D on either side of the pixel; with
+* big and small the larger and smaller of |gx| and |gy| his mag1 and mag2
+* are N/m00 with
+*     N = big*(A - m00) + small*(D - A)
+* The neighbours of both sides are selected with the direction codes and N
+* is formed exactly in 32 bits. Heath's float N/m00 can only have another
+* sign, or be 0, where |N| <= S/2^20 with S = |big*(A - m00)| + |small*(D - A)|
+* (the rounding is a few parts in 2^24 of S/m00), and it is exactly 0 where
+* S is. A vector with a lane that close to a tie, a lane without a magnitude
+* but with a neighbour that has one (it is tested with the gradient of an
+* earlier pixel) or a gradient of -32768 is left to non_max_supp_row, so the
+* result is byte-identical. The magnitudes must not be negative.
+*******************************************************************************/
+static void nms_row(const short *above, const short *mag, const short *below,
+                    const short *gradx, const short *grady, const unsigned char *dir,
+                    int ncols, unsigned char *result, nms_state *state)
+{
+    int c;
+    vs16 zero, m, gx, gy, code, xmajor, gxpos, gypos, big, small;
+    vs16 l, r, u, d, ul, ur, dl, dr, a1, d1, a2, d2;
+    vs16 pos1, neg1, zero1, pos2, neg2, zero2, valid, flat, possible, decided;
+
+    zero = vs16_dup(0);
+    for(c=1; c+VS16_LANES<=ncols-2; c+=VS16_LANES)
+    {
+        m = vs16_load(&mag[c]);
+        gx = vs16_load(&gradx[c]);
+        gy = vs16_load(&grady[c]);
+        code = vs16_load_u8(&dir[c]);
+        xmajor = vs16_cmpgt(vs16_and(code, vs16_dup(OCTANT_X_MAJOR)), zero);
+        gxpos = vs16_cmpgt(vs16_and(code, vs16_dup(OCTANT_GX_POSITIVE)), zero);
+        gypos = vs16_cmpgt(vs16_and(code, vs16_dup(OCTANT_GY_POSITIVE)), zero);
+        big = vs16_max(vs16_abs(gx), vs16_abs(gy));
+        small = vs16_min(vs16_abs(gx), vs16_abs(gy));
+
+        l = vs16_load(&mag[c-1]);
+        r = vs16_load(&mag[c+1]);
+        u = vs16_load(&above[c]);
+        d = vs16_load(&below[c]);
+        ul = vs16_load(&above[c-1]);
+        ur = vs16_load(&above[c+1]);
+        dl = vs16_load(&below[c-1]);
+        dr = vs16_load(&below[c+1]);
+
+        /* The neighbours against the gradient (1) and along it (2). */
+        a1 = vs16_select(xmajor, vs16_select(gxpos, l, r), vs16_select(gypos, u, d));
+        a2 = vs16_select(xmajor, vs16_select(gxpos, r, l), vs16_select(gypos, d, u));
+        d1 = vs16_select(gypos, vs16_select(gxpos, ul, ur), vs16_select(gxpos, dl, dr));
+        d2 = vs16_select(gypos, vs16_select(gxpos, dr, dl), vs16_select(gxpos, ur, ul));
+
+        nms_side(big, small, a1, d1, m, &pos1, &neg1, &zero1);
+        nms_side(big, small, a2, d2, m, &pos2, &neg2, &zero2);
+
+        /* mag1 > 0 or mag2 >= 0 suppresses, mag1 <= 0 and mag2 < 0 does not.
+         * small < 0 only for a gradient of -32768. A pixel without a
+         * magnitude in a flat neighbourhood has mag1 == mag2 == 0. */
+        valid = vs16_and(vs16_cmpgt(m, zero), vs16_cmpgt(small, vs16_dup(-1)));
+        possible = vs16_and(valid, vs16_and(vs16_or(neg1, zero1), neg2));
+        flat = vs16_cmpeq(vs16_or(vs16_or(vs16_or(m, l), vs16_or(r, u)),
+                                  vs16_or(vs16_or(d, ul), vs16_or(ur, vs16_or(dl, dr)))), zero);
+        decided = vs16_or(flat, vs16_or(possible,
+                              vs16_and(valid, vs16_or(pos1, vs16_or(pos2, zero2)))));
+
+        if(vs16_any(vs16_cmpeq(decided, zero)))
+        {
+            non_max_supp_row(&above[c-1], &mag[c-1], &below[c-1], &gradx[c-1], &grady[c-1],
+                             &dir[c-1], VS16_LANES+3, &result[c-1], state);
+            continue;
+        }
+
+        vs16_store_u8(&result[c], vs16_select(possible, vs16_dup(POSSIBLE_EDGE),
+                                              vs16_dup(NOEDGE)));
+        nms_advance(&mag[c], &gradx[c], &grady[c], VS16_LANES, state);
+    }
+
+    if(c < ncols-2)
+        non_max_supp_row(&above[c-1], &mag[c-1], &below[c-1], &gradx[c-1], &grady[c-1],
+                         &dir[c-1], ncols-c+1, &result[c-1], state);
+}
+
+/*******************************************************************************
+* PROCEDURE: collect_row
+* PURPOSE: Vector version of nms_collect_row. The possible edges of each
+* vector are found with a compare, and the vectors without any are skipped
+* with one test; the set bits of the others give the positions to append.
+*******************************************************************************/
+static void collect_row(const unsigned char *nms, const short *mag, const int *magsq,
+                        int pos, int n, nms_candidates *cand)
+{
+    int i, k, m, bits, count;
+    vs16 possible = vs16_dup(POSSIBLE_EDGE);
+
+    nms_candidates_reserve(cand, n);
+    cand->hist_shift = (mag != NULL) ? 0 : HIST_SQUARED_SHIFT;
+    count = cand->count;
+    for(i=pos; i+VS16_LANES<=pos+n; i+=VS16_LANES)
+    {
+        bits = vs16_bits(vs16_cmpeq(vs16_load_u8(&nms[i]), possible));
+        while(bits != 0)
+        {
+            k = i + __builtin_ctz(bits);
+            bits &= bits - 1;
+            m = (mag != NULL) ? mag[k] : magsq[k];
+            cand->pos[count] = k;
+            cand->mag[count++] = m;
+            nms_candidates_count(cand, m);
+        }
+    }
+    cand->count = count;
+
+    nms_collect_row(nms, mag, magsq, i, pos+n-i, cand);
+}
+
+/*******************************************************************************
+* PROCEDURE: non_max_supp_<simd>
+* PURPOSE: Vector version of non_max_supp: the direction codes of each row
+* are found with direction_row, the row is suppressed with nms_row and its
+* candidates are collected with collect_row.
+*******************************************************************************/
+void SIMD_FN(non_max_supp)(short *mag, short *gradx, short *grady, int nrows, int ncols,
+                           unsigned char *result, nms_candidates *cand)
+{
+    int r;
+    unsigned char *dir;
+    nms_state state = { 0, 0, 0.0f, 0.0f };
+
+    if((dir = (unsigned char *) malloc(ncols)) == NULL)
+    {
+        fprintf(stderr, "Error allocating the direction row.\n");
+        exit(1);
+    }
+
+    /* Zero the edges of the result image, like non_max_supp. */
+    memset(result, 0, ncols);
+    memset(&result[(nrows-1)*ncols], 0, ncols);
+    for(r=0; r<nrows; r++)
+        result[r*ncols] = result[r*ncols+ncols-1] = 0;
+
+    for(r=1; r<nrows-2; r++)
+    {
+        direction_row(&gradx[r*ncols], &grady[r*ncols], ncols, dir);
+        nms_row(&mag[(r-1)*ncols], &mag[r*ncols], &mag[(r+1)*ncols],
+                &gradx[r*ncols], &grady[r*ncols], dir, ncols, &result[r*ncols], &state);
+        if(cand != NULL)
+        {
+            collect_row(result, mag, NULL, r*ncols+1, ncols-3, cand);
+            nms_subpixel_row(mag, NULL, &gradx[r*ncols], &grady[r*ncols], ncols, cand);
+        }
+    }
+
+    free(dir);
+}
+
+/*******************************************************************************
+* PROCEDURE: gradient_nms_<simd>
+* PURPOSE: Vector version of gradient_nms: the derivatives and the magnitude
+* of each row are computed with the vector unit into a two row buffer and
+* the row above is then suppressed with nms_row.
+*******************************************************************************/
+void SIMD_FN(gradient_nms)(short int *smoothedim, int rows, int cols, short int *magnitude,
+                           unsigned char *nms, nms_candidates *cand)
+{
+    int r, q;
+    short int *dx, *dy;    /* The derivatives of the last two rows. */
+    unsigned char *dir;    /* And their direction codes. */
+    nms_state state = { 0, 0, 0.0f, 0.0f };
+
+    if(((dx = (short *) malloc(2*cols*sizeof(short))) == NULL) ||
+       ((dy = (short *) malloc(2*cols*sizeof(short))) == NULL) ||
+       ((dir = (unsigned char *) malloc(2*cols)) == NULL))
+    {
+        fprintf(stderr, "Error allocating the derivative rows.\n");
+        exit(1);
+    }
+
+    for(r=0; r<rows; r++)
+    {
+        derivative_row(smoothedim, r, rows, cols, &dx[(r%2)*cols], &dy[(r%2)*cols],
+                       &dir[(r%2)*cols]);
+        SIMD_FN(magnitude_x_y)(&dx[(r%2)*cols], &dy[(r%2)*cols], 1, cols, &magnitude[r*cols]);
+
+        q = r - 1;
+        if(q < 1 || q >= rows-2) continue;
+        nms_row(&magnitude[(q-1)*cols], &magnitude[q*cols], &magnitude[(q+1)*cols],
+                &dx[(q%2)*cols], &dy[(q%2)*cols], &dir[(q%2)*cols], cols,
+                &nms[q*cols], &state);
+        if(cand != NULL)
+        {
+            collect_row(nms, magnitude, NULL, q*cols+1, cols-3, cand);
+            nms_subpixel_row(magnitude, NULL, &dx[(q%2)*cols], &dy[(q%2)*cols], cols, cand);
+        }
+    }
+
+    clear_nms_border(nms, rows, cols);
+
+    free(dir);
+    free(dy);
+    free(dx);
+}
+
+/*******************************************************************************
+* PROCEDURE: squared_magnitude_row
+* PURPOSE: magsq = dx*dx + dy*dy for n pixels, summed in float like the
+* scalar gradient_nms_squared.
+*******************************************************************************/
+static void squared_magnitude_row(const short int *delta_x, const short int *delta_y, int n,
+                                  int *magsq)
+{
+    int pos, sq1, sq2;
+    vs16 dx, dy;
+
+    for(pos=0; pos+VS16_LANES<=n; pos+=VS16_LANES)
+    {
+        dx = vs16_load(&delta_x[pos]);
+        dy = vs16_load(&delta_y[pos]);
+
+        vs32_store(&magsq[pos], vf32_to_s32(vf32_add(
+            vs32_to_f32(vs32_mull_lo(dx, dx)), vs32_to_f32(vs32_mull_lo(dy, dy)))));
+        vs32_store(&magsq[pos+VS32_LANES], vf32_to_s32(vf32_add(
+            vs32_to_f32(vs32_mull_hi(dx, dx)), vs32_to_f32(vs32_mull_hi(dy, dy)))));
+    }
+    for(; pos<n; pos++)
+    {
+        sq1 = (int)delta_x[pos] * (int)delta_x[pos];
+        sq2 = (int)delta_y[pos] * (int)delta_y[pos];
+        magsq[pos] = (int)((float)sq1 + (float)sq2);
+    }
+}
+
+/*******************************************************************************
+* PROCEDURE: gradient_nms_squared_<simd>
+* PURPOSE: Vector version of gradient_nms_squared, the derivatives and the
+* squared magnitudes are computed with the vector unit.
+*******************************************************************************/
+void SIMD_FN(gradient_nms_squared)(short int *smoothedim, int rows, int cols, int *magsq,
+                                   unsigned char *nms, nms_candidates *cand)
+{
+    int r, q;
+    short int *dx, *dy;    /* The derivatives of the last two rows. */
+    unsigned char *dir;    /* And their direction codes. */
+
+    if(((dx = (short *) malloc(2*cols*sizeof(short))) == NULL) ||
+       ((dy = (short *) malloc(2*cols*sizeof(short))) == NULL) ||
+       ((dir = (unsigned char *) malloc(2*cols)) == NULL))
+    {
+        fprintf(stderr, "Error allocating the derivative rows.\n");
+        exit(1);
+    }
+
+    for(r=0; r<rows; r++)
+    {
+        derivative_row(smoothedim, r, rows, cols, &dx[(r%2)*cols], &dy[(r%2)*cols],
+                       &dir[(r%2)*cols]);
+        squared_magnitude_row(&dx[(r%2)*cols], &dy[(r%2)*cols], cols, &magsq[r*cols]);
+
+        q = r - 1;
+        if(q < 1 || q >= rows-2) continue;
+        non_max_supp_row_squared(&magsq[(q-1)*cols], &magsq[q*cols], &magsq[(q+1)*cols],
+                                 &dx[(q%2)*cols], &dy[(q%2)*cols], &dir[(q%2)*cols], cols,
+                                 &nms[q*cols]);
+        if(cand != NULL)
+        {
+            collect_row(nms, NULL, magsq, q*cols+1, cols-3, cand);
+            nms_subpixel_row(NULL, magsq, &dx[(q%2)*cols], &dy[(q%2)*cols], cols, cand);
+        }
+    }
+
+    clear_nms_border(nms, rows, cols);
+
+    free(dir);
+    free(dy);
+    free(dx);
+}
@@ -1,8 +1,36 @@
 #ifndef NEON_H
 #define NEON_H
 
-void make_gaussian_kernel(float sigma, float **kernel, int *windowsize);
-unsigned short int* gaussian_smooth_neon(unsigned char *image, int rows, int cols, float sigma, int complete_rows);
+#include "hysteresis.h"
 
-#endif /* NEON_H */
+/* Prototypes of the vectorised kernels in neon.c for one backend suffix. */
+#define NEON_KERNELS(simd) \
+unsigned short int* gaussian_smooth_##simd(unsigned char *image, int rows, int cols, \
+        float sigma, int complete_rows); \
+unsigned short int* gaussian_smooth_stream_##simd(unsigned char *image, int rows, int cols, \
+        float sigma, int complete_rows); \
+unsigned short int* gaussian_smooth_iir_##simd(unsigned char *image, int rows, int cols, \
+        float sigma, int complete_rows); \
+unsigned short int* gaussian_smooth_fixed_##simd(unsigned char *image, int rows, int cols, \
+        float sigma, int complete_rows); \
+void derrivative_x_y_##simd(short int *smoothedim, int rows, int cols, \
+        short int **delta_x, short int **delta_y); \
+void derivative_of_gaussian_##simd(unsigned char *image, int rows, int cols, float sigma, \
+        short int **delta_x, short int **delta_y); \
+void magnitude_x_y_##simd(short int *delta_x, short int *delta_y, int rows, int cols, \
+        short int *magnitude); \
+void radian_direction_##simd(short int *delta_x, short int *delta_y, int rows, int cols, \
+        float **dir_radians, int xdirtag, int ydirtag); \
+void non_max_supp_##simd(short *mag, short *gradx, short *grady, int nrows, int ncols, \
+        unsigned char *result, nms_candidates *cand); \
+void gradient_nms_##simd(short int *smoothedim, int rows, int cols, short int *magnitude, \
+        unsigned char *nms, nms_candidates *cand); \
+void gradient_nms_squared_##simd(short int *smoothedim, int rows, int cols, int *magsq, \
+        unsigned char *nms, nms_candidates *cand);
+
+NEON_KERNELS(neon)
+NEON_KERNELS(sse2)
+NEON_KERNELS(avx2)
+NEON_KERNELS(scalar)
 
+#endif /* NEON_H */
@@ -135,6 +135,54 @@ int write_pgm_image(char *outfilename, unsigned char *image, int rows,
     return(1);
 }
 
+/******************************************************************************
+* Function: write_pbm_image
+* Purpose: This function writes a bitmap in raw PBM format, like
+* write_pgm_image. Each row of image holds (cols+7)/8 bytes, one bit per
+* pixel with the first pixel in the high bit, and a set bit is black.
+******************************************************************************/
+int write_pbm_image(char *outfilename, unsigned char *image, int rows,
+                    int cols, char *comment)
+{
+    FILE *fp;
+
+    /***************************************************************************
+    * Open the output image file for writing if a filename was given. If no
+    * filename was provided, set fp to write to standard output.
+    ***************************************************************************/
+    if(outfilename == NULL) fp = stdout;
+    else
+    {
+        if((fp = fopen(outfilename, "w")) == NULL)
+        {
+            fprintf(stderr, "Error writing the file %s in write_pbm_image().\n",
+                    outfilename);
+            return(0);
+        }
+    }
+
+    /***************************************************************************
+    * Write the header information to the PBM file.
+    ***************************************************************************/
+    fprintf(fp, "P4\n");
+    if(comment != NULL)
+        if(strlen(comment) <= 70) fprintf(fp, "# %s\n", comment);
+    fprintf(fp, "%d %d\n", cols, rows);
+
+    /***************************************************************************
+    * Write the image data to the file.
+    ***************************************************************************/
+    if(rows != fwrite(image, (cols+7)/8, rows, fp))
+    {
+        fprintf(stderr, "Error writing the image data in write_pbm_image().\n");
+        if(fp != stdout) fclose(fp);
+        return(0);
+    }
+
+    if(fp != stdout) fclose(fp);
+    return(1);
+}
+
 /******************************************************************************
 * Function: read_ppm_image
 * Purpose: This function reads in an image in PPM format. The image can be
@@ -3,6 +3,7 @@
 
 int read_pgm_image(char *infilename, unsigned char **image, int *rows, int *cols);
 int write_pgm_image(char *outfilename, unsigned char *image, int rows, int cols, char *comment, int maxval);
+int write_pbm_image(char *outfilename, unsigned char *image, int rows, int cols, char *comment);
 
 #endif /* PGM_IO_H */
 
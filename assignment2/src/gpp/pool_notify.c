@@ -25,7 +25,7 @@
 #include "pgm_io.h"
 #include "canny_edge.h"
 #include "hysteresis.h"
-#include "neon.h"
+#include "dispatch.h"
 
 
 /* ---- Specify the fraction of computations to be performed on the NEON ----- */
@@ -420,6 +420,9 @@ NORMAL_API DSP_STATUS pool_notify_Execute (IN Uint32 numIterations, Uint8 proces
     unsigned char *edge = NULL;
 	unsigned short *smoothedIm = NULL;
     short int *delta_x,*delta_y,*magnitude;
+    int *magsq = NULL;        /* The squared magnitude, for MAGNITUDE_SQUARED. */
+    nms_candidates cand;      /* The pixels of nms that may be edges. */
+    edge_mask mask = { 0, 0, 0, NULL }; /* The edges, packed to bits. */
     float *dir_radians=NULL;
     char outfilename[128];    /* Name of the output "edge" image */
     int neon_rows;
@@ -450,7 +453,7 @@ NORMAL_API DSP_STATUS pool_notify_Execute (IN Uint32 numIterations, Uint8 proces
     #endif
     neonTime= get_usec();
 
-    smoothedIm = gaussian_smooth_neon(pool_notify_DataBuf,neon_rows+8,cols,2.5, rows);
+    smoothedIm = stages.gaussian_smooth_fixed(pool_notify_DataBuf,neon_rows+8,cols,2.5, rows);
 
     printf("---NEON execution time %lld us.\n", get_usec()-neonTime);
 
@@ -474,37 +477,61 @@ NORMAL_API DSP_STATUS pool_notify_Execute (IN Uint32 numIterations, Uint8 proces
 
     //CONTINUE THE REST
 
+    if((magnitude = (short *) malloc(rows*cols* sizeof(short))) == NULL)
+    {
+        fprintf(stderr, "Error allocating the magnitude image.\n");
+    }
+    if((nms = (unsigned char *) malloc(rows*cols*sizeof(unsigned char)))==NULL)
+    {
+        fprintf(stderr, "Error allocating the nms image.\n");
+    }
+    nms_candidates_init(&cand);
+    cand.subpixel = (options.subpixel != NULL);
+
+	#ifndef RADIANS
+    /* Derivatives, magnitude and non-maximal suppression in one pass. */
+    #ifdef DEBUG
+    Time1 = get_usec();
+    #endif
+    if(options.magnitude == MAGNITUDE_SQUARED)
+    {
+        if((magsq = (int *) malloc(rows*cols*sizeof(int))) == NULL)
+        {
+            fprintf(stderr, "Error allocating the squared magnitude image.\n");
+            exit(1);
+        }
+        stages.gradient_nms_squared((short int *)smoothedIm, rows, cols, magsq, nms, &cand);
+    }
+    else
+        stages.gradient_nms((short int *)smoothedIm, rows, cols, magnitude, nms, &cand);
+    #ifdef DEBUG
+    printf("gradient and non max supp execution time %lld us.\n", get_usec()-Time1);
+    #endif
+	#else
     #ifdef DEBUG
     Time1 = get_usec();
     #endif
-    derrivative_x_y((short int *)smoothedIm,rows,cols,&delta_x,&delta_y);
+    stages.derrivative_x_y((short int *)smoothedIm,rows,cols,&delta_x,&delta_y);
     #ifdef DEBUG
     printf("derrivative execution time %lld us.\n", get_usec()-Time1);
     #endif
 
-	#ifdef RADIANS
     #ifdef DEBUG
     Time2 = get_usec();
     #endif
-    radian_direction(delta_x,delta_y,rows,cols,&dir_radians,-1,-1);
+    stages.radian_direction(delta_x,delta_y,rows,cols,&dir_radians,-1,-1);
     #ifdef DEBUG
     printf("radian direction execution time %lld us.\n", get_usec()-Time2);
     #endif
-	#endif /* RADIAN */
 
     #ifdef DEBUG
     Time3 = get_usec();
     #endif
 
-    if((magnitude = (short *) malloc(rows*cols* sizeof(short))) == NULL)
-    {
-        fprintf(stderr, "Error allocating the magnitude image.\n");
-    }
-
     #ifdef VERBOSE
     printf("Computing the magnitude of the gradient.\n");
     #endif
-    magnitude_x_y(delta_x, delta_y, rows, cols, magnitude);
+    stages.magnitude_x_y(delta_x, delta_y, rows, cols, magnitude);
 	#ifdef DEBUG
     printf("magnitude execution time %lld us.\n", get_usec()-Time3);
     #endif
@@ -516,15 +543,15 @@ NORMAL_API DSP_STATUS pool_notify_Execute (IN Uint32 numIterations, Uint8 proces
     #ifdef VERBOSE
     printf("Computing the non_max_supp function.\n");
     #endif
-    if((nms = (unsigned char *) malloc(rows*cols*sizeof(unsigned char)))==NULL)
-    {
-        fprintf(stderr, "Error allocating the nms image.\n");
-    }
-    non_max_supp(magnitude, delta_x, delta_y, rows, cols, nms);
+    stages.non_max_supp(magnitude, delta_x, delta_y, rows, cols, nms, &cand);
     #ifdef DEBUG
     printf("non max supp execution time %lld us.\n", get_usec()-Time4);
     #endif
 
+    free(delta_x);
+    free(delta_y);
+	#endif /* RADIANS */
+
     #ifdef DEBUG
     Time5 = get_usec();
     #endif
@@ -536,7 +563,27 @@ NORMAL_API DSP_STATUS pool_notify_Execute (IN Uint32 numIterations, Uint8 proces
         fprintf(stderr, "Error allocating the edge image.\n");
         exit(1);
     }
-    apply_hysteresis(magnitude, nms, rows, cols, 0.5, 0.5, edge);
+    if(options.hysteresis == HYSTERESIS_UNION)
+        apply_hysteresis_union((magsq != NULL) ? NULL : magnitude, magsq, nms, rows, cols,
+                               0.5, 0.5, edge, &cand, options.threads);
+    else if(options.hysteresis == HYSTERESIS_RECONSTRUCT)
+        apply_hysteresis_reconstruct((magsq != NULL) ? NULL : magnitude, magsq, nms, rows, cols,
+                                     0.5, 0.5, edge, &cand);
+    else if(options.hysteresis == HYSTERESIS_PACKED)
+        apply_hysteresis_packed((magsq != NULL) ? NULL : magnitude, magsq, nms, rows, cols,
+                                0.5, 0.5, &mask, &cand);
+    else if(magsq != NULL)
+        stages.apply_hysteresis_squared(magsq, nms, rows, cols, 0.5, 0.5, edge, &cand);
+    else
+        stages.apply_hysteresis(magnitude, nms, rows, cols, 0.5, 0.5, edge, &cand);
+    if(options.hysteresis == HYSTERESIS_PACKED) edge_mask_bytes(&mask, edge);
+    else if(options.pbm != NULL)
+    {
+        edge_mask_init(&mask, rows, cols);
+        edge_mask_pack(&mask, edge);
+    }
+    if(options.pbm != NULL) write_edge_pbm(options.pbm, &mask);
+    if(options.subpixel != NULL) write_subpixel(options.subpixel, &cand, edge, rows, cols);
     #ifdef DEBUG
     printf("hysteresis execution time %lld us.\n", get_usec()-Time5);
     #endif
@@ -575,10 +622,11 @@ NORMAL_API DSP_STATUS pool_notify_Execute (IN Uint32 numIterations, Uint8 proces
     free(image);
 
 
-    free(delta_x);
-    free(delta_y);
     free(magnitude);
+    free(magsq);
     free(nms);
+    nms_candidates_free(&cand);
+    edge_mask_free(&mask);
     free(edge);
 	#ifdef DEBUG
     printf("free execution time %lld us.\n", get_usec()-Time7);
@@ -0,0 +1,610 @@
+/*******************************************************************************
+* FILE: simd.h
+* PURPOSE: Thin vector abstraction used by the vectorised Canny kernels. The
+* same kernel source is built against one of the following backends, picked
+* from the compiler target flags:
+*
+*   SIMD_NEON    ARMv7 NEON, 128-bit registers (the Beagle board).
+*   SIMD_AVX2    x86 AVX2, 256-bit registers.
+*   SIMD_SSE2    x86 SSE2, 128-bit registers.
+*   SIMD_SCALAR  Plain C fallback, 128-bit worth of lanes in a struct.
+*
+* Defining SIMD_FORCE_SCALAR selects the scalar backend on any target.
+*
+* The vector types are named after their element type, not their width:
+*
+*   vf32  float           VF32_LANES lanes
+*   vs32  signed int      VS32_LANES lanes (== VF32_LANES)
+*   vs16  signed short    VS16_LANES lanes (== 2 * VS32_LANES)
+*   vu8   unsigned char   VU8_LANES  lanes (== 2 * VS16_LANES)
+*
+* so a kernel written as "for(c=0; c+VF32_LANES<=cols; c+=VF32_LANES)" runs
+* on 4 lanes with NEON/SSE2 and on 8 lanes with AVX2. Widening operations
+* split a vector into its low and high halves in memory order, narrowing
+* operations put them back together in the same order. All loads and stores
+* are unaligned.
+*******************************************************************************/
+
+#ifndef SIMD_H
+#define SIMD_H
+
+#if defined(SIMD_FORCE_SCALAR)
+#define SIMD_SCALAR
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define SIMD_NEON
+#elif defined(__AVX2__)
+#define SIMD_AVX2
+#elif defined(__SSE2__)
+#define SIMD_SSE2
+#else
+#define SIMD_SCALAR
+#endif
+
+#include <string.h>
+
+/* Kernels built on this header are named SIMD_FN(name), which expands to
+ * name_neon, name_sse2, name_avx2 or name_scalar. */
+#define SIMD_PASTE_(name, suffix) name##_##suffix
+#define SIMD_PASTE(name, suffix) SIMD_PASTE_(name, suffix)
+#define SIMD_FN(name) SIMD_PASTE(name, SIMD_SUFFIX)
+
+#if defined(SIMD_NEON)
+#include <arm_neon.h>
+#elif defined(SIMD_AVX2)
+#include <immintrin.h>
+#elif defined(SIMD_SSE2)
+#include <emmintrin.h>
+#else
+#include <math.h>
+#endif
+
+/*******************************************************************************
+* ARMv7 NEON
+*******************************************************************************/
+#if defined(SIMD_NEON)
+
+#define SIMD_NAME "neon"
+#define SIMD_SUFFIX neon
+#define VF32_LANES 4
+#define VS32_LANES 4
+#define VS16_LANES 8
+#define VU8_LANES 16
+
+typedef float32x4_t vf32;
+typedef int32x4_t vs32;
+typedef int16x8_t vs16;
+typedef uint8x16_t vu8;
+
+static inline vf32 vf32_load(const float *p) { return vld1q_f32(p); }
+static inline void vf32_store(float *p, vf32 v) { vst1q_f32(p, v); }
+static inline vf32 vf32_dup(float x) { return vdupq_n_f32(x); }
+static inline vf32 vf32_add(vf32 a, vf32 b) { return vaddq_f32(a, b); }
+static inline vf32 vf32_sub(vf32 a, vf32 b) { return vsubq_f32(a, b); }
+static inline vf32 vf32_mul(vf32 a, vf32 b) { return vmulq_f32(a, b); }
+static inline vf32 vf32_max(vf32 a, vf32 b) { return vmaxq_f32(a, b); }
+static inline vf32 vf32_mla(vf32 acc, vf32 a, vf32 b) { return vmlaq_f32(acc, a, b); }
+static inline vf32 vf32_min(vf32 a, vf32 b) { return vminq_f32(a, b); }
+static inline vf32 vf32_abs(vf32 a) { return vabsq_f32(a); }
+/* ARMv7 has no vector divide either: a reciprocal estimate refined with two
+ * Newton-Raphson steps, b must not be 0. */
+static inline vf32 vf32_div(vf32 a, vf32 b)
+{
+    float32x4_t e = vrecpeq_f32(b);
+    e = vmulq_f32(e, vrecpsq_f32(b, e));
+    e = vmulq_f32(e, vrecpsq_f32(b, e));
+    return vmulq_f32(a, e);
+}
+/* All ones where a < b, zero elsewhere, and the lanes of a where mask is set
+ * and of b elsewhere. */
+static inline vs32 vf32_cmplt(vf32 a, vf32 b) { return vreinterpretq_s32_u32(vcltq_f32(a, b)); }
+static inline vf32 vf32_select(vs32 mask, vf32 a, vf32 b) { return vbslq_f32(vreinterpretq_u32_s32(mask), a, b); }
+
+static inline float vf32_hsum(vf32 v)
+{
+    float32x2_t s = vpadd_f32(vget_low_f32(v), vget_high_f32(v));
+    return vget_lane_f32(vpadd_f32(s, s), 0);
+}
+
+/* ARMv7 has no vector square root: reciprocal square root estimate refined
+ * with two Newton-Raphson steps, with 0 mapped to 0 instead of 0*inf. */
+static inline vf32 vf32_sqrt(vf32 x)
+{
+    float32x4_t e = vrsqrteq_f32(x);
+    e = vmulq_f32(e, vrsqrtsq_f32(vmulq_f32(x, e), e));
+    e = vmulq_f32(e, vrsqrtsq_f32(vmulq_f32(x, e), e));
+    return vbslq_f32(vceqq_f32(x, vdupq_n_f32(0.0f)), x, vmulq_f32(x, e));
+}
+
+/* Load VF32_LANES bytes and widen them to float. */
+static inline vf32 vf32_load_u8(const unsigned char *p)
+{
+    unsigned int w;
+    uint8x8_t b;
+    memcpy(&w, p, 4);
+    b = vreinterpret_u8_u32(vdup_n_u32(w));
+    return vcvtq_f32_u32(vmovl_u16(vget_low_u16(vmovl_u8(b))));
+}
+
+static inline vs32 vf32_to_s32(vf32 v) { return vcvtq_s32_f32(v); }
+static inline vf32 vs32_to_f32(vs32 v) { return vcvtq_f32_s32(v); }
+
+static inline vs16 vs16_load(const short *p) { return vld1q_s16(p); }
+static inline void vs16_store(short *p, vs16 v) { vst1q_s16(p, v); }
+static inline vs16 vs16_add(vs16 a, vs16 b) { return vaddq_s16(a, b); }
+static inline vs16 vs16_sub(vs16 a, vs16 b) { return vsubq_s16(a, b); }
+static inline vs16 vs16_abs(vs16 a) { return vabsq_s16(a); }
+static inline vs16 vs16_max(vs16 a, vs16 b) { return vmaxq_s16(a, b); }
+static inline vs16 vs16_min(vs16 a, vs16 b) { return vminq_s16(a, b); }
+/* Arithmetic shift right by n bits. */
+static inline vs16 vs16_shr(vs16 a, int n) { return vshlq_s16(a, vdupq_n_s16((short)-n)); }
+static inline vs16 vs16_dup(short x) { return vdupq_n_s16(x); }
+/* Compares give all ones in the lanes where they hold, zero elsewhere. */
+static inline vs16 vs16_cmpgt(vs16 a, vs16 b) { return vreinterpretq_s16_u16(vcgtq_s16(a, b)); }
+static inline vs16 vs16_cmpeq(vs16 a, vs16 b) { return vreinterpretq_s16_u16(vceqq_s16(a, b)); }
+static inline vs16 vs16_and(vs16 a, vs16 b) { return vandq_s16(a, b); }
+static inline vs16 vs16_or(vs16 a, vs16 b) { return vorrq_s16(a, b); }
+/* The lanes of a where mask is set and of b elsewhere; whether any lane of
+ * mask is set. */
+static inline vs16 vs16_select(vs16 mask, vs16 a, vs16 b) { return vbslq_s16(vreinterpretq_u16_s16(mask), a, b); }
+static inline int vs16_any(vs16 mask)
+{
+    int16x4_t m = vorr_s16(vget_low_s16(mask), vget_high_s16(mask));
+    return vget_lane_s64(vreinterpret_s64_s16(m), 0) != 0;
+}
+/* Bit i set where lane i of mask is set: the lanes are weighted with their
+ * bit and added up pairwise. */
+static inline int vs16_bits(vs16 mask)
+{
+    static const short weight[8] = { 1, 2, 4, 8, 16, 32, 64, 128 };
+    int16x8_t b = vandq_s16(mask, vld1q_s16(weight));
+    int16x4_t s = vpadd_s16(vget_low_s16(b), vget_high_s16(b));
+    s = vpadd_s16(s, s);
+    s = vpadd_s16(s, s);
+    return vget_lane_s16(s, 0);
+}
+
+/* The vector one lane on from a (a[1..], b[0]) and one lane back from b
+ * (a[last], b[..]), for the neighbours of a row held in registers. */
+static inline vs16 vs16_next(vs16 a, vs16 b) { return vextq_s16(a, b, 1); }
+static inline vs16 vs16_prev(vs16 a, vs16 b) { return vextq_s16(a, b, 7); }
+
+static inline vs32 vs32_load(const int *p) { return vld1q_s32(p); }
+static inline void vs32_store(int *p, vs32 v) { vst1q_s32(p, v); }
+static inline vs32 vs32_add(vs32 a, vs32 b) { return vaddq_s32(a, b); }
+static inline vs32 vs32_widen_lo(vs16 a) { return vmovl_s16(vget_low_s16(a)); }
+static inline vs32 vs32_widen_hi(vs16 a) { return vmovl_s16(vget_high_s16(a)); }
+
+/* Widening multiply of the low/high halves: (int)a[i] * (int)b[i]. */
+static inline vs32 vs32_mull_lo(vs16 a, vs16 b)
+{
+    return vmull_s16(vget_low_s16(a), vget_low_s16(b));
+}
+static inline vs32 vs32_mull_hi(vs16 a, vs16 b)
+{
+    return vmull_s16(vget_high_s16(a), vget_high_s16(b));
+}
+
+/* Saturating narrow of two int vectors into one short vector. */
+static inline vs16 vs16_narrow(vs32 lo, vs32 hi)
+{
+    return vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi));
+}
+
+/* Load VS16_LANES bytes zero-extended to short. */
+static inline vs16 vs16_load_u8(const unsigned char *p)
+{
+    return vreinterpretq_s16_u16(vmovl_u8(vld1_u8(p)));
+}
+
+/* Store VS16_LANES shorts as bytes, saturated to 0..255. */
+static inline void vs16_store_u8(unsigned char *p, vs16 v)
+{
+    vst1_u8(p, vqmovun_s16(v));
+}
+
+/* acc + a*k on the low/high half of a, with a and k taken as unsigned short. */
+static inline vs32 vs32_mlal_lo_u16(vs32 acc, vs16 a, unsigned short k)
+{
+    return vreinterpretq_s32_u32(vmlal_n_u16(vreinterpretq_u32_s32(acc),
+                                 vget_low_u16(vreinterpretq_u16_s16(a)), k));
+}
+static inline vs32 vs32_mlal_hi_u16(vs32 acc, vs16 a, unsigned short k)
+{
+    return vreinterpretq_s32_u32(vmlal_n_u16(vreinterpretq_u32_s32(acc),
+                                 vget_high_u16(vreinterpretq_u16_s16(a)), k));
+}
+
+static inline vs32 vs32_dup(int x) { return vdupq_n_s32(x); }
+static inline vs32 vs32_sub(vs32 a, vs32 b) { return vsubq_s32(a, b); }
+static inline vs32 vs32_mul(vs32 a, vs32 b) { return vmulq_s32(a, b); }
+/* All ones where a > b, zero elsewhere. */
+static inline vs32 vs32_cmpgt(vs32 a, vs32 b) { return vreinterpretq_s32_u32(vcgtq_s32(a, b)); }
+static inline vs32 vs32_cmpeq(vs32 a, vs32 b) { return vreinterpretq_s32_u32(vceqq_s32(a, b)); }
+static inline vs32 vs32_abs(vs32 a) { return vabsq_s32(a); }
+static inline vs32 vs32_shr(vs32 a, int n) { return vshlq_s32(a, vdupq_n_s32(-n)); }
+static inline vs32 vs32_and(vs32 a, vs32 b) { return vandq_s32(a, b); }
+static inline vs32 vs32_or(vs32 a, vs32 b) { return vorrq_s32(a, b); }
+
+/*******************************************************************************
+* x86 AVX2
+*******************************************************************************/
+#elif defined(SIMD_AVX2)
+
+#define SIMD_NAME "avx2"
+#define SIMD_SUFFIX avx2
+#define VF32_LANES 8
+#define VS32_LANES 8
+#define VS16_LANES 16
+#define VU8_LANES 32
+
+typedef __m256 vf32;
+typedef __m256i vs32;
+typedef __m256i vs16;
+typedef __m256i vu8;
+
+static inline vf32 vf32_load(const float *p) { return _mm256_loadu_ps(p); }
+static inline void vf32_store(float *p, vf32 v) { _mm256_storeu_ps(p, v); }
+static inline vf32 vf32_dup(float x) { return _mm256_set1_ps(x); }
+static inline vf32 vf32_add(vf32 a, vf32 b) { return _mm256_add_ps(a, b); }
+static inline vf32 vf32_sub(vf32 a, vf32 b) { return _mm256_sub_ps(a, b); }
+static inline vf32 vf32_mul(vf32 a, vf32 b) { return _mm256_mul_ps(a, b); }
+static inline vf32 vf32_max(vf32 a, vf32 b) { return _mm256_max_ps(a, b); }
+static inline vf32 vf32_min(vf32 a, vf32 b) { return _mm256_min_ps(a, b); }
+static inline vf32 vf32_abs(vf32 a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+static inline vf32 vf32_div(vf32 a, vf32 b) { return _mm256_div_ps(a, b); }
+static inline vs32 vf32_cmplt(vf32 a, vf32 b) { return _mm256_castps_si256(_mm256_cmp_ps(a, b, _CMP_LT_OQ)); }
+static inline vf32 vf32_select(vs32 mask, vf32 a, vf32 b) { return _mm256_blendv_ps(b, a, _mm256_castsi256_ps(mask)); }
+static inline vf32 vf32_mla(vf32 acc, vf32 a, vf32 b)
+{
+    return _mm256_add_ps(acc, _mm256_mul_ps(a, b));
+}
+
+static inline float vf32_hsum(vf32 v)
+{
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+}
+
+static inline vf32 vf32_sqrt(vf32 x) { return _mm256_sqrt_ps(x); }
+
+static inline vf32 vf32_load_u8(const unsigned char *p)
+{
+    __m128i b = _mm_loadl_epi64((const __m128i *)p);
+    return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(b));
+}
+
+static inline vs32 vf32_to_s32(vf32 v) { return _mm256_cvttps_epi32(v); }
+static inline vf32 vs32_to_f32(vs32 v) { return _mm256_cvtepi32_ps(v); }
+
+static inline vs16 vs16_load(const short *p) { return _mm256_loadu_si256((const __m256i *)p); }
+static inline void vs16_store(short *p, vs16 v) { _mm256_storeu_si256((__m256i *)p, v); }
+static inline vs16 vs16_add(vs16 a, vs16 b) { return _mm256_add_epi16(a, b); }
+static inline vs16 vs16_sub(vs16 a, vs16 b) { return _mm256_sub_epi16(a, b); }
+static inline vs16 vs16_abs(vs16 a) { return _mm256_abs_epi16(a); }
+static inline vs16 vs16_max(vs16 a, vs16 b) { return _mm256_max_epi16(a, b); }
+static inline vs16 vs16_min(vs16 a, vs16 b) { return _mm256_min_epi16(a, b); }
+static inline vs16 vs16_shr(vs16 a, int n) { return _mm256_sra_epi16(a, _mm_cvtsi32_si128(n)); }
+static inline vs16 vs16_dup(short x) { return _mm256_set1_epi16(x); }
+static inline vs16 vs16_cmpgt(vs16 a, vs16 b) { return _mm256_cmpgt_epi16(a, b); }
+static inline vs16 vs16_cmpeq(vs16 a, vs16 b) { return _mm256_cmpeq_epi16(a, b); }
+static inline vs16 vs16_and(vs16 a, vs16 b) { return _mm256_and_si256(a, b); }
+static inline vs16 vs16_or(vs16 a, vs16 b) { return _mm256_or_si256(a, b); }
+static inline vs16 vs16_select(vs16 mask, vs16 a, vs16 b) { return _mm256_blendv_epi8(b, a, mask); }
+static inline int vs16_any(vs16 mask) { return _mm256_movemask_epi8(mask) != 0; }
+static inline int vs16_bits(vs16 mask)
+{
+    return _mm_movemask_epi8(_mm_packs_epi16(_mm256_castsi256_si128(mask),
+                                             _mm256_extracti128_si256(mask, 1)));
+}
+
+/* The byte shifts of AVX2 stay within 128-bit lanes, the lane crossing
+ * halves are brought together with a permute first. */
+static inline vs16 vs16_next(vs16 a, vs16 b)
+{
+    return _mm256_alignr_epi8(_mm256_permute2x128_si256(a, b, 0x21), a, 2);
+}
+static inline vs16 vs16_prev(vs16 a, vs16 b)
+{
+    return _mm256_alignr_epi8(b, _mm256_permute2x128_si256(a, b, 0x21), 14);
+}
+
+static inline vs32 vs32_load(const int *p) { return _mm256_loadu_si256((const __m256i *)p); }
+static inline void vs32_store(int *p, vs32 v) { _mm256_storeu_si256((__m256i *)p, v); }
+static inline vs32 vs32_add(vs32 a, vs32 b) { return _mm256_add_epi32(a, b); }
+static inline vs32 vs32_widen_lo(vs16 a) { return _mm256_cvtepi16_epi32(_mm256_castsi256_si128(a)); }
+static inline vs32 vs32_widen_hi(vs16 a) { return _mm256_cvtepi16_epi32(_mm256_extracti128_si256(a, 1)); }
+
+static inline vs32 vs32_mull_lo(vs16 a, vs16 b)
+{
+    return _mm256_mullo_epi32(_mm256_cvtepi16_epi32(_mm256_castsi256_si128(a)),
+                              _mm256_cvtepi16_epi32(_mm256_castsi256_si128(b)));
+}
+static inline vs32 vs32_mull_hi(vs16 a, vs16 b)
+{
+    return _mm256_mullo_epi32(_mm256_cvtepi16_epi32(_mm256_extracti128_si256(a, 1)),
+                              _mm256_cvtepi16_epi32(_mm256_extracti128_si256(b, 1)));
+}
+
+/* packs works per 128-bit lane, the permute restores memory order. */
+static inline vs16 vs16_narrow(vs32 lo, vs32 hi)
+{
+    return _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xD8);
+}
+
+static inline vs16 vs16_load_u8(const unsigned char *p)
+{
+    return _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)p));
+}
+
+static inline void vs16_store_u8(unsigned char *p, vs16 v)
+{
+    __m256i b = _mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), 0x08);
+    _mm_storeu_si128((__m128i *)p, _mm256_castsi256_si128(b));
+}
+
+static inline vs32 vs32_mlal_lo_u16(vs32 acc, vs16 a, unsigned short k)
+{
+    return _mm256_add_epi32(acc, _mm256_mullo_epi32(
+               _mm256_cvtepu16_epi32(_mm256_castsi256_si128(a)), _mm256_set1_epi32(k)));
+}
+static inline vs32 vs32_mlal_hi_u16(vs32 acc, vs16 a, unsigned short k)
+{
+    return _mm256_add_epi32(acc, _mm256_mullo_epi32(
+               _mm256_cvtepu16_epi32(_mm256_extracti128_si256(a, 1)), _mm256_set1_epi32(k)));
+}
+
+static inline vs32 vs32_dup(int x) { return _mm256_set1_epi32(x); }
+static inline vs32 vs32_sub(vs32 a, vs32 b) { return _mm256_sub_epi32(a, b); }
+static inline vs32 vs32_mul(vs32 a, vs32 b) { return _mm256_mullo_epi32(a, b); }
+static inline vs32 vs32_cmpgt(vs32 a, vs32 b) { return _mm256_cmpgt_epi32(a, b); }
+static inline vs32 vs32_cmpeq(vs32 a, vs32 b) { return _mm256_cmpeq_epi32(a, b); }
+static inline vs32 vs32_abs(vs32 a) { return _mm256_abs_epi32(a); }
+static inline vs32 vs32_shr(vs32 a, int n) { return _mm256_sra_epi32(a, _mm_cvtsi32_si128(n)); }
+static inline vs32 vs32_and(vs32 a, vs32 b) { return _mm256_and_si256(a, b); }
+static inline vs32 vs32_or(vs32 a, vs32 b) { return _mm256_or_si256(a, b); }
+
+/*******************************************************************************
+* x86 SSE2
+*******************************************************************************/
+#elif defined(SIMD_SSE2)
+
+#define SIMD_NAME "sse2"
+#define SIMD_SUFFIX sse2
+#define VF32_LANES 4
+#define VS32_LANES 4
+#define VS16_LANES 8
+#define VU8_LANES 16
+
+typedef __m128 vf32;
+typedef __m128i vs32;
+typedef __m128i vs16;
+typedef __m128i vu8;
+
+static inline vf32 vf32_load(const float *p) { return _mm_loadu_ps(p); }
+static inline void vf32_store(float *p, vf32 v) { _mm_storeu_ps(p, v); }
+static inline vf32 vf32_dup(float x) { return _mm_set1_ps(x); }
+static inline vf32 vf32_add(vf32 a, vf32 b) { return _mm_add_ps(a, b); }
+static inline vf32 vf32_sub(vf32 a, vf32 b) { return _mm_sub_ps(a, b); }
+static inline vf32 vf32_mul(vf32 a, vf32 b) { return _mm_mul_ps(a, b); }
+static inline vf32 vf32_max(vf32 a, vf32 b) { return _mm_max_ps(a, b); }
+static inline vf32 vf32_min(vf32 a, vf32 b) { return _mm_min_ps(a, b); }
+static inline vf32 vf32_abs(vf32 a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+static inline vf32 vf32_div(vf32 a, vf32 b) { return _mm_div_ps(a, b); }
+static inline vs32 vf32_cmplt(vf32 a, vf32 b) { return _mm_castps_si128(_mm_cmplt_ps(a, b)); }
+static inline vf32 vf32_select(vs32 mask, vf32 a, vf32 b)
+{
+    __m128 m = _mm_castsi128_ps(mask);
+    return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b));
+}
+static inline vf32 vf32_mla(vf32 acc, vf32 a, vf32 b)
+{
+    return _mm_add_ps(acc, _mm_mul_ps(a, b));
+}
+
+static inline float vf32_hsum(vf32 v)
+{
+    __m128 s = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+}
+
+static inline vf32 vf32_sqrt(vf32 x) { return _mm_sqrt_ps(x); }
+
+static inline vf32 vf32_load_u8(const unsigned char *p)
+{
+    __m128i z = _mm_setzero_si128();
+    int w;
+    __m128i b;
+    memcpy(&w, p, 4);
+    b = _mm_cvtsi32_si128(w);
+    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(b, z), z));
+}
+
+static inline vs32 vf32_to_s32(vf32 v) { return _mm_cvttps_epi32(v); }
+static inline vf32 vs32_to_f32(vs32 v) { return _mm_cvtepi32_ps(v); }
+
+static inline vs16 vs16_load(const short *p) { return _mm_loadu_si128((const __m128i *)p); }
+static inline void vs16_store(short *p, vs16 v) { _mm_storeu_si128((__m128i *)p, v); }
+static inline vs16 vs16_add(vs16 a, vs16 b) { return _mm_add_epi16(a, b); }
+static inline vs16 vs16_sub(vs16 a, vs16 b) { return _mm_sub_epi16(a, b); }
+/* SSE2 has no 16-bit abs, it is max(a, -a). */
+static inline vs16 vs16_abs(vs16 a) { return _mm_max_epi16(a, _mm_sub_epi16(_mm_setzero_si128(), a)); }
+static inline vs16 vs16_max(vs16 a, vs16 b) { return _mm_max_epi16(a, b); }
+static inline vs16 vs16_min(vs16 a, vs16 b) { return _mm_min_epi16(a, b); }
+static inline vs16 vs16_shr(vs16 a, int n) { return _mm_sra_epi16(a, _mm_cvtsi32_si128(n)); }
+static inline vs16 vs16_dup(short x) { return _mm_set1_epi16(x); }
+static inline vs16 vs16_cmpgt(vs16 a, vs16 b) { return _mm_cmpgt_epi16(a, b); }
+static inline vs16 vs16_cmpeq(vs16 a, vs16 b) { return _mm_cmpeq_epi16(a, b); }
+static inline vs16 vs16_and(vs16 a, vs16 b) { return _mm_and_si128(a, b); }
+static inline vs16 vs16_or(vs16 a, vs16 b) { return _mm_or_si128(a, b); }
+static inline vs16 vs16_select(vs16 mask, vs16 a, vs16 b)
+{
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+static inline int vs16_any(vs16 mask) { return _mm_movemask_epi8(mask) != 0; }
+static inline int vs16_bits(vs16 mask) { return _mm_movemask_epi8(_mm_packs_epi16(mask, _mm_setzero_si128())); }
+
+static inline vs16 vs16_next(vs16 a, vs16 b)
+{
+    return _mm_or_si128(_mm_srli_si128(a, 2), _mm_slli_si128(b, 14));
+}
+static inline vs16 vs16_prev(vs16 a, vs16 b)
+{
+    return _mm_or_si128(_mm_srli_si128(a, 14), _mm_slli_si128(b, 2));
+}
+
+static inline vs32 vs32_load(const int *p) { return _mm_loadu_si128((const __m128i *)p); }
+static inline void vs32_store(int *p, vs32 v) { _mm_storeu_si128((__m128i *)p, v); }
+static inline vs32 vs32_add(vs32 a, vs32 b) { return _mm_add_epi32(a, b); }
+/* The sign of each short, from a compare, becomes its high half. */
+static inline vs32 vs32_widen_lo(vs16 a) { return _mm_unpacklo_epi16(a, _mm_cmpgt_epi16(_mm_setzero_si128(), a)); }
+static inline vs32 vs32_widen_hi(vs16 a) { return _mm_unpackhi_epi16(a, _mm_cmpgt_epi16(_mm_setzero_si128(), a)); }
+
+/* SSE2 has no 32-bit multiply: combine the low and high 16-bit products. */
+static inline vs32 vs32_mull_lo(vs16 a, vs16 b)
+{
+    return _mm_unpacklo_epi16(_mm_mullo_epi16(a, b), _mm_mulhi_epi16(a, b));
+}
+static inline vs32 vs32_mull_hi(vs16 a, vs16 b)
+{
+    return _mm_unpackhi_epi16(_mm_mullo_epi16(a, b), _mm_mulhi_epi16(a, b));
+}
+
+static inline vs16 vs16_narrow(vs32 lo, vs32 hi) { return _mm_packs_epi32(lo, hi); }
+
+static inline vs16 vs16_load_u8(const unsigned char *p)
+{
+    return _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)p), _mm_setzero_si128());
+}
+
+static inline void vs16_store_u8(unsigned char *p, vs16 v)
+{
+    _mm_storel_epi64((__m128i *)p, _mm_packus_epi16(v, v));
+}
+
+static inline vs32 vs32_mlal_lo_u16(vs32 acc, vs16 a, unsigned short k)
+{
+    __m128i kk = _mm_set1_epi16((short)k);
+    return _mm_add_epi32(acc, _mm_unpacklo_epi16(_mm_mullo_epi16(a, kk), _mm_mulhi_epu16(a, kk)));
+}
+static inline vs32 vs32_mlal_hi_u16(vs32 acc, vs16 a, unsigned short k)
+{
+    __m128i kk = _mm_set1_epi16((short)k);
+    return _mm_add_epi32(acc, _mm_unpackhi_epi16(_mm_mullo_epi16(a, kk), _mm_mulhi_epu16(a, kk)));
+}
+
+static inline vs32 vs32_dup(int x) { return _mm_set1_epi32(x); }
+static inline vs32 vs32_sub(vs32 a, vs32 b) { return _mm_sub_epi32(a, b); }
+/* Low 32 bits of the products, from the two 64-bit even/odd multiplies. */
+static inline vs32 vs32_mul(vs32 a, vs32 b)
+{
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0,0,2,0)),
+                              _mm_shuffle_epi32(odd, _MM_SHUFFLE(0,0,2,0)));
+}
+static inline vs32 vs32_cmpgt(vs32 a, vs32 b) { return _mm_cmpgt_epi32(a, b); }
+static inline vs32 vs32_cmpeq(vs32 a, vs32 b) { return _mm_cmpeq_epi32(a, b); }
+/* SSE2 has no 32-bit abs either: flip the bits of the negative lanes and add 1. */
+static inline vs32 vs32_abs(vs32 a)
+{
+    __m128i s = _mm_srai_epi32(a, 31);
+    return _mm_sub_epi32(_mm_xor_si128(a, s), s);
+}
+static inline vs32 vs32_shr(vs32 a, int n) { return _mm_sra_epi32(a, _mm_cvtsi32_si128(n)); }
+static inline vs32 vs32_and(vs32 a, vs32 b) { return _mm_and_si128(a, b); }
+static inline vs32 vs32_or(vs32 a, vs32 b) { return _mm_or_si128(a, b); }
+
+/*******************************************************************************
+* Scalar fallback
+*******************************************************************************/
+#else
+
+#define SIMD_NAME "scalar"
+#define SIMD_SUFFIX scalar
+#define VF32_LANES 4
+#define VS32_LANES 4
+#define VS16_LANES 8
+#define VU8_LANES 16
+
+typedef struct { float v[VF32_LANES]; } vf32;
+typedef struct { int v[VS32_LANES]; } vs32;
+typedef struct { short v[VS16_LANES]; } vs16;
+typedef struct { unsigned char v[VU8_LANES]; } vu8;
+
+#define SIMD_LANEWISE(n, expr) { int i; for(i=0; i<(n); i++) { expr; } }
+
+static inline vf32 vf32_load(const float *p) { vf32 r; SIMD_LANEWISE(VF32_LANES, r.v[i] = p[i]) return r; }
+static inline void vf32_store(float *p, vf32 a) SIMD_LANEWISE(VF32_LANES, p[i] = a.v[i])
+static inline vf32 vf32_dup(float x) { vf32 r; SIMD_LANEWISE(VF32_LANES, r.v[i] = x) return r; }
+static inline vf32 vf32_add(vf32 a, vf32 b) { vf32 r; SIMD_LANEWISE(VF32_LANES, r.v[i] = a.v[i] + b.v[i]) return r; }
+static inline vf32 vf32_sub(vf32 a, vf32 b) { vf32 r; SIMD_LANEWISE(VF32_LANES, r.v[i] = a.v[i] - b.v[i]) return r; }
+static inline vf32 vf32_mul(vf32 a, vf32 b) { vf32 r; SIMD_LANEWISE(VF32_LANES, r.v[i] = a.v[i] * b.v[i]) return r; }
+static inline vf32 vf32_max(vf32 a, vf32 b) { vf32 r; SIMD_LANEWISE(VF32_LANES, r.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i]) return r; }
+static inline vf32 vf32_mla(vf32 acc, vf32 a, vf32 b) { vf32 r; SIMD_LANEWISE(VF32_LANES, r.v[i] = acc.v[i] + a.v[i] * b.v[i]) return r; }
+static inline vf32 vf32_min(vf32 a, vf32 b) { vf32 r; SIMD_LANEWISE(VF32_LANES, r.v[i] = a.v[i] < b.v[i] ? a.v[i] : b.v[i]) return r; }
+static inline vf32 vf32_abs(vf32 a) { vf32 r; SIMD_LANEWISE(VF32_LANES, r.v[i] = fabsf(a.v[i])) return r; }
+static inline vf32 vf32_div(vf32 a, vf32 b) { vf32 r; SIMD_LANEWISE(VF32_LANES, r.v[i] = a.v[i] / b.v[i]) return r; }
+static inline vs32 vf32_cmplt(vf32 a, vf32 b) { vs32 r; SIMD_LANEWISE(VS32_LANES, r.v[i] = a.v[i] < b.v[i] ? -1 : 0) return r; }
+static inline vf32 vf32_select(vs32 mask, vf32 a, vf32 b) { vf32 r; SIMD_LANEWISE(VF32_LANES, r.v[i] = mask.v[i] ? a.v[i] : b.v[i]) return r; }
+static inline float vf32_hsum(vf32 a) { float s = 0.0f; SIMD_LANEWISE(VF32_LANES, s += a.v[i]) return s; }
+static inline vf32 vf32_sqrt(vf32 a) { vf32 r; SIMD_LANEWISE(VF32_LANES, r.v[i] = sqrtf(a.v[i])) return r; }
+static inline vf32 vf32_load_u8(const unsigned char *p) { vf32 r; SIMD_LANEWISE(VF32_LANES, r.v[i] = (float)p[i]) return r; }
+static inline vs32 vf32_to_s32(vf32 a) { vs32 r; SIMD_LANEWISE(VS32_LANES, r.v[i] = (int)a.v[i]) return r; }
+static inline vf32 vs32_to_f32(vs32 a) { vf32 r; SIMD_LANEWISE(VF32_LANES, r.v[i] = (float)a.v[i]) return r; }
+
+static inline vs16 vs16_load(const short *p) { vs16 r; SIMD_LANEWISE(VS16_LANES, r.v[i] = p[i]) return r; }
+static inline void vs16_store(short *p, vs16 a) SIMD_LANEWISE(VS16_LANES, p[i] = a.v[i])
+static inline vs16 vs16_add(vs16 a, vs16 b) { vs16 r; SIMD_LANEWISE(VS16_LANES, r.v[i] = a.v[i] + b.v[i]) return r; }
+static inline vs16 vs16_sub(vs16 a, vs16 b) { vs16 r; SIMD_LANEWISE(VS16_LANES, r.v[i] = a.v[i] - b.v[i]) return r; }
+static inline vs16 vs16_abs(vs16 a) { vs16 r; SIMD_LANEWISE(VS16_LANES, r.v[i] = (a.v[i] < 0) ? -a.v[i] : a.v[i]) return r; }
+static inline vs16 vs16_max(vs16 a, vs16 b) { vs16 r; SIMD_LANEWISE(VS16_LANES, r.v[i] = (a.v[i] > b.v[i]) ? a.v[i] : b.v[i]) return r; }
+static inline vs16 vs16_min(vs16 a, vs16 b) { vs16 r; SIMD_LANEWISE(VS16_LANES, r.v[i] = (a.v[i] < b.v[i]) ? a.v[i] : b.v[i]) return r; }
+static inline vs16 vs16_shr(vs16 a, int n) { vs16 r; SIMD_LANEWISE(VS16_LANES, r.v[i] = a.v[i] >> n) return r; }
+static inline vs16 vs16_dup(short x) { vs16 r; SIMD_LANEWISE(VS16_LANES, r.v[i] = x) return r; }
+static inline vs16 vs16_cmpgt(vs16 a, vs16 b) { vs16 r; SIMD_LANEWISE(VS16_LANES, r.v[i] = a.v[i] > b.v[i] ? -1 : 0) return r; }
+static inline vs16 vs16_cmpeq(vs16 a, vs16 b) { vs16 r; SIMD_LANEWISE(VS16_LANES, r.v[i] = a.v[i] == b.v[i] ? -1 : 0) return r; }
+static inline vs16 vs16_and(vs16 a, vs16 b) { vs16 r; SIMD_LANEWISE(VS16_LANES, r.v[i] = a.v[i] & b.v[i]) return r; }
+static inline vs16 vs16_or(vs16 a, vs16 b) { vs16 r; SIMD_LANEWISE(VS16_LANES, r.v[i] = a.v[i] | b.v[i]) return r; }
+static inline vs16 vs16_select(vs16 mask, vs16 a, vs16 b) { vs16 r; SIMD_LANEWISE(VS16_LANES, r.v[i] = mask.v[i] ? a.v[i] : b.v[i]) return r; }
+static inline int vs16_any(vs16 mask) { int r = 0; SIMD_LANEWISE(VS16_LANES, r |= mask.v[i]) return r != 0; }
+static inline int vs16_bits(vs16 mask) { int r = 0; SIMD_LANEWISE(VS16_LANES, r |= (mask.v[i] & 1) << i) return r; }
+static inline vs16 vs16_next(vs16 a, vs16 b) { vs16 r; SIMD_LANEWISE(VS16_LANES, r.v[i] = (i+1 < VS16_LANES) ? a.v[i+1] : b.v[0]) return r; }
+static inline vs16 vs16_prev(vs16 a, vs16 b) { vs16 r; SIMD_LANEWISE(VS16_LANES, r.v[i] = (i > 0) ? b.v[i-1] : a.v[VS16_LANES-1]) return r; }
+
+static inline vs32 vs32_load(const int *p) { vs32 r; SIMD_LANEWISE(VS32_LANES, r.v[i] = p[i]) return r; }
+static inline void vs32_store(int *p, vs32 a) SIMD_LANEWISE(VS32_LANES, p[i] = a.v[i])
+static inline vs32 vs32_add(vs32 a, vs32 b) { vs32 r; SIMD_LANEWISE(VS32_LANES, r.v[i] = a.v[i] + b.v[i]) return r; }
+static inline vs32 vs32_widen_lo(vs16 a) { vs32 r; SIMD_LANEWISE(VS32_LANES, r.v[i] = a.v[i]) return r; }
+static inline vs32 vs32_widen_hi(vs16 a) { vs32 r; SIMD_LANEWISE(VS32_LANES, r.v[i] = a.v[i+VS32_LANES]) return r; }
+static inline vs32 vs32_mull_lo(vs16 a, vs16 b) { vs32 r; SIMD_LANEWISE(VS32_LANES, r.v[i] = (int)a.v[i] * (int)b.v[i]) return r; }
+static inline vs32 vs32_mull_hi(vs16 a, vs16 b) { vs32 r; SIMD_LANEWISE(VS32_LANES, r.v[i] = (int)a.v[i+VS32_LANES] * (int)b.v[i+VS32_LANES]) return r; }
+
+static inline vs16 vs16_narrow(vs32 lo, vs32 hi)
+{
+    vs16 r;
+    SIMD_LANEWISE(VS32_LANES, r.v[i] = (short)(lo.v[i] > 32767 ? 32767 : (lo.v[i] < -32768 ? -32768 : lo.v[i])))
+    SIMD_LANEWISE(VS32_LANES, r.v[i+VS32_LANES] = (short)(hi.v[i] > 32767 ? 32767 : (hi.v[i] < -32768 ? -32768 : hi.v[i])))
+    return r;
+}
+
+static inline vs16 vs16_load_u8(const unsigned char *p) { vs16 r; SIMD_LANEWISE(VS16_LANES, r.v[i] = p[i]) return r; }
+static inline void vs16_store_u8(unsigned char *p, vs16 a) SIMD_LANEWISE(VS16_LANES, p[i] = (unsigned char)(a.v[i] > 255 ? 255 : (a.v[i] < 0 ? 0 : a.v[i])))
+static inline vs32 vs32_mlal_lo_u16(vs32 acc, vs16 a, unsigned short k) { SIMD_LANEWISE(VS32_LANES, acc.v[i] += (unsigned short)a.v[i] * (unsigned)k) return acc; }
+static inline vs32 vs32_mlal_hi_u16(vs32 acc, vs16 a, unsigned short k) { SIMD_LANEWISE(VS32_LANES, acc.v[i] += (unsigned short)a.v[i+VS32_LANES] * (unsigned)k) return acc; }
+
+static inline vs32 vs32_dup(int x) { vs32 r; SIMD_LANEWISE(VS32_LANES, r.v[i] = x) return r; }
+static inline vs32 vs32_sub(vs32 a, vs32 b) { vs32 r; SIMD_LANEWISE(VS32_LANES, r.v[i] = a.v[i] - b.v[i]) return r; }
+static inline vs32 vs32_mul(vs32 a, vs32 b) { vs32 r; SIMD_LANEWISE(VS32_LANES, r.v[i] = (int)((unsigned)a.v[i] * (unsigned)b.v[i])) return r; }
+static inline vs32 vs32_cmpgt(vs32 a, vs32 b) { vs32 r; SIMD_LANEWISE(VS32_LANES, r.v[i] = a.v[i] > b.v[i] ? -1 : 0) return r; }
+static inline vs32 vs32_cmpeq(vs32 a, vs32 b) { vs32 r; SIMD_LANEWISE(VS32_LANES, r.v[i] = a.v[i] == b.v[i] ? -1 : 0) return r; }
+static inline vs32 vs32_abs(vs32 a) { vs32 r; SIMD_LANEWISE(VS32_LANES, r.v[i] = (a.v[i] < 0) ? -a.v[i] : a.v[i]) return r; }
+static inline vs32 vs32_shr(vs32 a, int n) { vs32 r; SIMD_LANEWISE(VS32_LANES, r.v[i] = a.v[i] >> n) return r; }
+static inline vs32 vs32_and(vs32 a, vs32 b) { vs32 r; SIMD_LANEWISE(VS32_LANES, r.v[i] = a.v[i] & b.v[i]) return r; }
+static inline vs32 vs32_or(vs32 a, vs32 b) { vs32 r; SIMD_LANEWISE(VS32_LANES, r.v[i] = a.v[i] | b.v[i]) return r; }
+
+#endif
+
+#endif /* SIMD_H */